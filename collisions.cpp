@@ -7,6 +7,9 @@
 #include "particles.hpp"
 #include "density.hpp"
 #include "times.hpp"
+#include "configuration.hpp"
+
+#include "checkpoint.hpp"
 
 CollisionHandler::CollisionHandler(DSMC* dsmc):
   Motherbase(dsmc),
@@ -18,13 +21,28 @@ CollisionHandler::CollisionHandler(DSMC* dsmc):
   vrmax11( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
   anew( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
   vrmaxnew( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
+  cand_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  real_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  over_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  cand_cell_tot( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  real_cell_tot( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  over_cell_tot( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
   n_coll_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
-  scaled_k( 0.0, 3 ),
-  rel_vel( 0.0, 3 ),
-  delta( 0.0, 3 ),
-  cells_ind( grid->get_n_cells(), 0 ),
+  routine_choice( conf->get_routine_choice() ),
+  routine(),
+  cells_ind(),
+  split_type( conf->get_split_type() ),
+  colors(),
+  work(),
+  work_blocks(),
+  cell_color(),
+  cell_block(),
+  thread_rng(),
+  counter_rng( 1 + (int)( rng->sample_uniform() * 2147483646.0 ) ),
+  thread_counters(),
+  thread_batch(),
   npart( ensemble->get_n_particles() ),
-  nx( grid->get_n_cells_y() ),
+  nx( grid->get_n_cells_x() ),
   ny( grid->get_n_cells_y() ),
   xmin( grid->get_x_min() ),
   xmax( grid->get_x_max() ),
@@ -33,112 +51,382 @@ CollisionHandler::CollisionHandler(DSMC* dsmc):
   rdx( grid->get_rdx() ),
   rdy( grid->get_rdy() ),
   sigma( species->get_diam_fluid() ),
-  delta_t( times->get_delta_t() )
-  { }
+  delta_t( times->get_delta_t() ),
+  chi_ref( density->get_chi_ref() ),
+  n_halo_x( density->get_n_halo_x() ),
+  n_halo_y( density->get_n_halo_y() )
+  {
+    std::cout << "### SETTING-UP COLLISION STAGE ###" << std::endl;
+    setup_colors();
+    setup_thread_rng();
+    set_routine(routine_choice);
+    std::cout << " >> split type = " << split_type << ";\tcolours = " << colors.size()
+      << ";\tthreads = " << thread_rng.size() << ";\troutine = " << routine->name() << std::endl;
+  }
+
+void
+CollisionHandler::setup_colors
+(void)
+{
+  int nx = grid->get_n_cells_x(), ny = grid->get_n_cells_y();
+  // Reach of a collision partner (in cells)
+  int rx = (int)std::ceil( sigma*rdx ), ry = (int)std::ceil( sigma*rdy );
+  colors.clear();
+  switch ( split_type )
+  {
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    case SerialSplit:
+      break;
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    case BlockSplit:
+    {
+      // Blocks at least (2r+1) cells wide, even number of blocks (periodic wrap)
+      int nbx = std::max( 1, nx/(2*rx+1) ), nby = std::max( 1, ny/(2*ry+1) );
+      if ( nbx > 1 && nbx%2 == 1 ) nbx--;
+      if ( nby > 1 && nby%2 == 1 ) nby--;
+      colors.assign( 4, std::vector< std::vector<int> >() );
+      for (int bi = 0; bi<nbx; ++bi)
+      {
+        for (int bj = 0; bj<nby; ++bj)
+        {
+          std::vector<int> block;
+          for (int i = bi*nx/nbx; i<(bi+1)*nx/nbx; ++i)
+            for (int j = bj*ny/nby; j<(bj+1)*ny/nby; ++j)
+              block.push_back( grid->lexico(i,j) );
+          colors[ (bi%2) + 2*(bj%2) ].push_back( block );
+        }
+      }
+      break;
+    }
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    case StrideSplit:
+    {
+      // Stride (2r+1); the last incomplete period gets colours of its own
+      int px = 2*rx+1, py = 2*ry+1;
+      int qx = (nx/px)*px, qy = (ny/py)*py;
+      int ncx = px + (nx-qx), ncy = py + (ny-qy);
+      int cx, cy;
+      colors.assign( ncx*ncy, std::vector< std::vector<int> >() );
+      for (int i = 0; i<nx; ++i)
+      {
+        cx = ( i<qx ) ? i%px : px+(i-qx);
+        for (int j = 0; j<ny; ++j)
+        {
+          cy = ( j<qy ) ? j%py : py+(j-qy);
+          colors[ cx + ncx*cy ].push_back( std::vector<int>(1, grid->lexico(i,j)) );
+        }
+      }
+      break;
+    }
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    default:
+      std::cerr << "[!] UNRECOGNIZED SPLIT TYPE: SERIAL COLLISIONS" << std::endl;
+      split_type = SerialSplit;
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+  }
+  // Drop empty colour classes
+  colors.erase( std::remove_if( colors.begin(), colors.end(),
+    [](const std::vector< std::vector<int> >& c) { return c.empty(); } ), colors.end() );
+  // Map each cell to its colour and block; work lists share the same layout
+  cell_color.assign( nx*ny, 0 );
+  cell_block.assign( nx*ny, 0 );
+  work.assign( colors.size(), std::vector< std::vector<int> >() );
+  work_blocks.assign( colors.size(), std::vector<int>() );
+  for (std::size_t c = 0; c<colors.size(); ++c)
+  {
+    work[c].resize( colors[c].size() );
+    for (std::size_t b = 0; b<colors[c].size(); ++b)
+    {
+      for (auto it = colors[c][b].cbegin(); it!=colors[c][b].cend(); ++it)
+      {
+        cell_color[*it] = c;
+        cell_block[*it] = b;
+      }
+    }
+  }
+}
+
+void
+CollisionHandler::set_routine
+(int choice)
+{
+  routine_choice = choice;
+  switch ( routine_choice )
+  {
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    case PoissonScheme:
+      routine = DefaultPointer<AbstractCollisionRoutine>( new CollisionRoutine<PoissonScheme>() );
+      break;
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    case MajorantScheme:
+      routine = DefaultPointer<AbstractCollisionRoutine>( new CollisionRoutine<MajorantScheme>() );
+      break;
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+    default:
+      std::cerr << "[!] UNRECOGNIZED COLLISION ROUTINE: MAJORANT SCHEME" << std::endl;
+      routine_choice = MajorantScheme;
+      routine = DefaultPointer<AbstractCollisionRoutine>( new CollisionRoutine<MajorantScheme>() );
+    /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
+  }
+}
+
+void
+CollisionHandler::setup_thread_rng
+(void)
+{
+  int nt = ev_parallel::max_threads();
+#if COUNTER_BASED_RNG
+  // The main RNG must not depend on the number of threads
+  CounterEngine seeds = counter_rng.stream(2);
+#else
+  RandomEngine& seeds = *rng;
+#endif
+  thread_rng.clear();
+  for (int t = 0; t<nt; ++t)
+    thread_rng.push_back( DefaultPointer<RandomEngine>(
+      new RandomEngine( 1 + (int)( seeds.sample_uniform() * 2147483646.0 ) ) ) );
+  thread_counters.assign( nt, CollisionCounters() );
+  thread_batch.resize( nt );
+}
 
 void
 CollisionHandler::compute_majorants
 (void)
 {
-  int idx_p1, ip1, jp1, idx_ck, ick, jck, ichk, jchk, jjp2, jp2;
-  real_number xk, yk, xkh, ykh, chi11;
-  int np2;
   int ntest = TEST_COEFF_MULT*npart;
+  if ( (int)thread_rng.size() < ev_parallel::max_threads() )
+    setup_thread_rng();
+  int nt = thread_rng.size();
   // Reset all majorants
   a11.fill(0.0);
   anew.fill(0.0);
   vrmax11.fill(0.0);
   vrmaxnew.fill(0.0);
-  for (int itest = 0; itest<ntest; itest++)
+  // Private majorants for each thread
+  std::vector< ev_matrix::MaskMatrix<real_number> > a11_loc(nt, a11), anew_loc(nt, anew);
+  std::vector< ev_matrix::MaskMatrix<real_number> > vrmax11_loc(nt, vrmax11), vrmaxnew_loc(nt, vrmaxnew);
+  // Test pairs draw from substreams (estimate, test) of stream 1, if COUNTER_BASED_RNG
+  const CounterEngine majorant_rng = counter_rng.stream(1);
+  const uint32_t step = n_majorant_steps++;
+  #pragma omp parallel
   {
-    idx_p1 = (int)( rng->sample_uniform() * npart );
-    ip1 = (int)( ( ensemble->get_xp(idx_p1) - xmin ) * rdx );
-    jp1 = (int)( ( ensemble->get_yp(idx_p1) - ymin ) * rdy );
-    /*
-    ip1 = ensemble->get_cx(idx_p1);
-    jp1 = ensemble->get_cx(idx_p1);
-    */
-    gen_scaled_k();
-    xk = ensemble->get_xp(idx_p1) - scaled_k[0];
-    yk = ensemble->get_yp(idx_p1) - scaled_k[1];
-    /* WHAT ABOUT PERIODIC B.C. ??? */
-    if ( ( xk >= xmin && xk <= xmax ) && ( yk >= ymin && yk <= ymax ) )
+    int t = ev_parallel::thread_id();
+#if !COUNTER_BASED_RNG
+    RandomEngine& engine = *thread_rng[t];
+#endif
+    ev_matrix::MaskMatrix<real_number>& a11_t = a11_loc[t];
+    ev_matrix::MaskMatrix<real_number>& anew_t = anew_loc[t];
+    ev_matrix::MaskMatrix<real_number>& vrmax11_t = vrmax11_loc[t];
+    ev_matrix::MaskMatrix<real_number>& vrmaxnew_t = vrmaxnew_loc[t];
+    int idx_p1, ip1, jp1, idx_ck, ick, jck, idx_chk, ichk, jchk, jjp2, jp2;
+    real_number xk, yk, chi11, vr;
+    real_number kx, ky, kz;
+    int np2;
+    #pragma omp for schedule(static)
+    for (int itest = 0; itest<ntest; itest++)
     {
-      xkh = xk + scaled_k[0]/2.0;
-      ykh = yk + scaled_k[1]/2.0;
-      ick = (int)( ( xk - xmin ) * rdx );
-      jck = (int)( ( yk - ymin ) * rdy );
-      idx_ck = grid->lexico(ick, jck);
-      if ( density->get_npc(ick, jck) >= 1 )
+#if COUNTER_BASED_RNG
+      CounterEngine engine = majorant_rng.substream(step, itest);
+#endif
+      idx_p1 = (int)( engine.sample_uniform() * npart );
+      ip1 = (int)( ( ensemble->get_xp(idx_p1) - xmin ) * rdx );
+      jp1 = (int)( ( ensemble->get_yp(idx_p1) - ymin ) * rdy );
+      gen_scaled_k(engine, kx, ky, kz);
+      xk = ensemble->get_xp(idx_p1) - kx;
+      yk = ensemble->get_yp(idx_p1) - ky;
+      // Partners beyond periodic edges are found through the ghost cells
+      idx_ck = owner_cell(xk, yk);
+      if ( idx_ck >= 0 )
       {
-        ichk = (int)( (xkh - xmin) * rdx );
-        jchk = (int)( (ykh - ymin) * rdy );
-        chi11 = correlation( density->get_aveta(ichk, jchk) );
-        a11(ip1, jp1) = std::max(a11(ip1, jp1), density->get_numdens(ip1, jp1) * chi11);
-        a11(ick, jck) = std::max(a11(ick, jck), density->get_numdens(ick, jck) * chi11);
-        anew(ip1, jp1) = a11(ip1, jp1);
-        np2 = density->iof(idx_ck);
-        jjp2 = np2 + (int)( rng->sample_uniform() * density->get_npc(ick, jck) );
-        jp2 = density->ind(jjp2);
-        vr = sqrt (
-            ev_utility::power<2>( ensemble->get_vx(jp2) - ensemble->get_vx(idx_p1) )
-          + ev_utility::power<2>( ensemble->get_vy(jp2) - ensemble->get_vy(idx_p1) )
-          + ev_utility::power<2>( ensemble->get_vz(jp2) - ensemble->get_vz(idx_p1) )
-        );
-        vrmax11(ip1, jp1) = std::max( vrmax11(ip1, jp1), vr );
-        vrmax11(ick,jck) = std::max( vrmax11(ick,jck), vr );
-        vrmaxnew(ip1, jp1) = vrmax11(ip1, jp1);
-        vrmaxnew(ick, jck) = vrmax11(ick, jck);
+        jck = idx_ck / nx;
+        ick = idx_ck - jck*nx;
+        if ( density->get_npc(ick, jck) >= 1 )
+        {
+          idx_chk = owner_contact(xk + kx/2.0, yk + ky/2.0);
+          jchk = idx_chk / (chi_ref*nx);
+          ichk = idx_chk - jchk*chi_ref*nx;
+          chi11 = density->get_chi_contact(ichk, jchk);
+          a11_t(ip1, jp1) = std::max(a11_t(ip1, jp1), density->get_numdens(ip1, jp1) * chi11);
+          a11_t(ick, jck) = std::max(a11_t(ick, jck), density->get_numdens(ick, jck) * chi11);
+          anew_t(ip1, jp1) = a11_t(ip1, jp1);
+          np2 = density->iof(idx_ck);
+          jjp2 = np2 + (int)( engine.sample_uniform() * density->get_npc(ick, jck) );
+          jp2 = density->ind(jjp2);
+          vr = sqrt (
+              ev_utility::power<2>( ensemble->get_vx(jp2) - ensemble->get_vx(idx_p1) )
+            + ev_utility::power<2>( ensemble->get_vy(jp2) - ensemble->get_vy(idx_p1) )
+            + ev_utility::power<2>( ensemble->get_vz(jp2) - ensemble->get_vz(idx_p1) )
+          );
+          vrmax11_t(ip1, jp1) = std::max( vrmax11_t(ip1, jp1), vr );
+          vrmax11_t(ick,jck) = std::max( vrmax11_t(ick,jck), vr );
+          vrmaxnew_t(ip1, jp1) = vrmax11_t(ip1, jp1);
+          vrmaxnew_t(ick, jck) = vrmax11_t(ick, jck);
+        }
       }
     }
   }
+  // Element-wise max reduction of private majorants
+  for (int t = 0; t<nt; ++t)
+  {
+    a11 = a11.max(a11_loc[t]);
+    anew = anew.max(anew_loc[t]);
+    vrmax11 = vrmax11.max(vrmax11_loc[t]);
+    vrmaxnew = vrmaxnew.max(vrmaxnew_loc[t]);
+  }
 }
 
 void
 CollisionHandler::compute_collision_number
 (void)
 {
-  int nx = grid->get_n_cells_x(), ny = grid->get_n_cells_y();
-  real_number pfnc, cnc;
+  int nx = grid->get_n_cells_x();
+  int i, j;
+  real_number cnc;
   n_coll_cell = 0;
   n_coll = 0;
-  for (int i = 0; i<nx; ++i)
+  cells_ind.clear();
+  // Only occupied cells may host the first particle of a collision
+  const std::vector<int>& active_cells = density->get_active_cells();
+  for (auto it = active_cells.cbegin(); it!=active_cells.cend(); ++it)
   {
-    for (int j = 0; j<ny; ++j)
-    {
-      // cnc = ev_const::pi2*sigma*sigma*a11(i,j)*vrmax11(i,j)*delta_t;
-      cnc = ev_const::pi2*sigma*sigma*a11(i,j)*vrmax11(i,j)*delta_t;
-      n_coll_cell(i,j) = (int)cnc;
-      pfnc = cnc - n_coll_cell(i,j);
-      if ( rng->sample_uniform() < pfnc ) n_coll_cell(i,j)++;
-    }
+    j = *it / nx;
+    i = *it - j * nx;
+    // cnc = ev_const::pi2*sigma*sigma*a11(i,j)*vrmax11(i,j)*delta_t;
+    cnc = ev_const::pi2*sigma*sigma*a11(i,j)*vrmax11(i,j)*delta_t;
+    n_coll_cell(i,j) = routine->draw_candidates( cnc, *rng );
+    n_coll += n_coll_cell(i,j);
+    if ( n_coll_cell(i,j) > 0 )
+      cells_ind.push_back(*it);
   }
-  n_coll = n_coll_cell.sum();
 }
 
 void
-CollisionHandler::setup_cell_ind
-(void)
+CollisionHandler::collide_cell
+(int idx_cell1, int t, CandidateBatch& batch, CollisionCounters& counters)
 {
-  int nc = grid->get_n_cells();
-  for (int i = 0; i<nc; ++i)
-    cells_ind[i] = i;
+#if COUNTER_BASED_RNG
+  (void)t;
+  CounterEngine engine = counter_rng.substream(n_collision_steps, idx_cell1);
+  collide_cell(idx_cell1, engine, batch, counters);
+#else
+  collide_cell(idx_cell1, *thread_rng[t], batch, counters);
+#endif
 }
 
+template <class Engine>
 void
-CollisionHandler::perform_collisions
-(void)
+CollisionHandler::collide_cell
+(int idx_cell1, Engine& engine, CandidateBatch& batch, CollisionCounters& counters)
 {
+  int j_cell1 = idx_cell1 / nx;
+  int i_cell1 = idx_cell1 - j_cell1 * nx;
+  int n_cand = n_coll_cell(i_cell1, j_cell1);
+  int npc1 = density->get_npc(i_cell1, j_cell1);
+  if ( n_cand == 0 || npc1 == 0 )
+    return;
+  batch.reserve(n_cand);
+  const int iof1 = density->iof(idx_cell1);
+  real_number* u_p1 = batch.rnd.data();
+  real_number* u_cos = u_p1 + n_cand;
+  real_number* u_phi = u_cos + n_cand;
+  real_number* u_p2 = u_phi + n_cand;
+  real_number* u_acc = u_p2 + n_cand;
+  // (1) Draw all random numbers of the cell (qualified call: no virtual dispatch)
+  engine.Engine::fill_uniform(batch.rnd.data(), 5*n_cand);
+  // (2) Scaled k-vectors, uniform on the sphere of radius sigma
+  for (int m = 0; m < n_cand; ++m)
+  {
+    real_number c = 2.0 * u_cos[m] - 1.0;
+    real_number s = sigma * sqrt( 1.0 - c*c );
+    real_number phi = ev_const::pi2 * u_phi[m];
+    batch.kx[m] = sigma * c;
+    batch.ky[m] = s * cos(phi);
+    batch.kz[m] = s * sin(phi);
+  }
+  // (3) First particles, target cells and contact cells (ghost cells for b.c., |k| < sigma)
+  for (int m = 0; m < n_cand; ++m)
+  {
+    int idx_p1 = density->ind( iof1 + (int)( u_p1[m] * npc1 ) );
+    real_number xk = ensemble->get_xp(idx_p1) - batch.kx[m];
+    real_number yk = ensemble->get_yp(idx_p1) - batch.ky[m];
+    batch.p1[m] = idx_p1;
+    batch.c2[m] = owner_cell( xk, yk );
+    batch.ch[m] = owner_contact( xk + 0.5*batch.kx[m], yk + 0.5*batch.ky[m] );
+  }
+  // (4) Acceptance and velocity updates
+  real_number numdens1 = density->get_numdens(i_cell1, j_cell1);
+  real_number& anew1 = anew(i_cell1, j_cell1);
+  real_number& vrmaxnew1 = vrmaxnew(i_cell1, j_cell1);
+  int n_cand1 = 0, n_real1 = 0, n_over1 = 0;
+  for (int m = 0; m < n_cand; ++m)
+  {
+    int idx_cell2 = batch.c2[m];
+    if ( idx_cell2 < 0 )
+      continue;
+    int j_cell2 = idx_cell2 / nx;
+    int i_cell2 = idx_cell2 - j_cell2 * nx;
+    int npc2 = density->get_npc(i_cell2, j_cell2);
+    if ( npc2 == 0 )
+      continue;
+    int idx_p1 = batch.p1[m];
+    int idx_p2 = density->ind( density->iof(idx_cell2) + (int)( u_p2[m] * npc2 ) );
+    real_number kx = batch.kx[m], ky = batch.ky[m], kz = batch.kz[m];
+    real_number gx = ensemble->get_vx(idx_p2) - ensemble->get_vx(idx_p1);
+    real_number gy = ensemble->get_vy(idx_p2) - ensemble->get_vy(idx_p1);
+    real_number gz = ensemble->get_vz(idx_p2) - ensemble->get_vz(idx_p1);
+    real_number vr = sqrt( gx*gx + gy*gy + gz*gz );
+    vrmaxnew1 = std::max( vrmaxnew1, vr );
+    vrmaxnew(i_cell2, j_cell2) = std::max( vrmaxnew(i_cell2, j_cell2), vr );
+    real_number scalar_prod = ( gx*kx + gy*ky + gz*kz ) / sigma;
+    int j_h = batch.ch[m] / (chi_ref*nx);
+    real_number chi = density->get_chi_contact(batch.ch[m] - j_h*chi_ref*nx, j_h);
+    real_number aa = density->get_numdens(i_cell2, j_cell2) * chi;
+    anew1 = std::max( anew1, aa );
+    anew(i_cell2, j_cell2) = std::max( anew(i_cell2, j_cell2), numdens1 * chi );
+    if( a11(i_cell2, j_cell2) == 0.0 )
+      a11(i_cell2, j_cell2) = anew(i_cell2, j_cell2);
+    if( scalar_prod > 0.0 )
+    {
+      // vrmax11 HAS NOT BEEN UPDATED! WHY?
+      real_number fk = scalar_prod * aa / ( a11(i_cell1, j_cell1) * vrmax11(i_cell1, j_cell1) );
+      if (fk > 1.0)
+      {
+        counters.n_fake_idx++;
+        n_over1++;
+      }
+      if ( u_acc[m] < fk )
+      {
+        counters.n_real++;
+        n_real1++;
+        scalar_prod /= sigma;
+        ensemble->get_vx(idx_p1) += kx*scalar_prod;
+        ensemble->get_vy(idx_p1) += ky*scalar_prod;
+        ensemble->get_vz(idx_p1) += kz*scalar_prod;
+        ensemble->get_vx(idx_p2) -= kx*scalar_prod;
+        ensemble->get_vy(idx_p2) -= ky*scalar_prod;
+        ensemble->get_vz(idx_p2) -= kz*scalar_prod;
+      }
+      else
+      {
+        counters.n_fake++;
+      }
+      counters.n_total++;
+      n_cand1++;
+    }
+  }
+  // Cell1 belongs to the calling thread's block: no race on its counters
+  cand_cell(i_cell1, j_cell1) += n_cand1;
+  real_cell(i_cell1, j_cell1) += n_real1;
+  over_cell(i_cell1, j_cell1) += n_over1;
+}
 
-  int nc = grid->get_n_cells();
-  int idx, idx_cell1, i_cell1, j_cell1, idx_p1;
-  int idx_cell2, idx_hcell2, i_cell2, j_cell2, idx_p2;
-  real_number xk, yk, xkh, ykh, aa, fk;
-  // Set-up
-  setup_cell_ind();
-  compute_collision_number();
-  // Reset number of collisions
-  n_fake_idx = 0; n_fake = 0; n_real = 0; n_total = 0;
+void
+CollisionHandler::perform_collisions_serial
+(void)
+{
+  int nc = cells_ind.size();
+  int idx, idx_cell1;
+  CollisionCounters counters;
   while ( nc > 0 )
   {
     // (1) Select a cell at random with with equiprobability
@@ -146,82 +434,75 @@ CollisionHandler::perform_collisions
     idx_cell1 = cells_ind[idx];
     cells_ind[idx] = cells_ind[nc-1];
     nc -= 1;
-    i_cell1 = grid->lexico_inv(idx_cell1).first;
-    j_cell1 = grid->lexico_inv(idx_cell1).second;
-    // (2) Select a particle belonging to cell at random with equiprobability
-    for (int i1 = 0; i1 < n_coll_cell(i_cell1, j_cell1); i1++)
+#if COUNTER_BASED_RNG
+    collide_cell(idx_cell1, 0, thread_batch[0], counters);
+#else
+    collide_cell(idx_cell1, *rng, thread_batch[0], counters);
+#endif
+  }
+  n_fake = counters.n_fake;
+  n_real = counters.n_real;
+  n_total = counters.n_total;
+  n_fake_idx = counters.n_fake_idx;
+}
+
+void
+CollisionHandler::perform_collisions_colored
+(void)
+{
+  if ( (int)thread_rng.size() < ev_parallel::max_threads() )
+    setup_thread_rng();
+  thread_counters.assign( thread_rng.size(), CollisionCounters() );
+  // (1) Cells having candidates are dispatched to their block
+  for (std::size_t c = 0; c<work.size(); ++c)
+  {
+    for (auto it = work_blocks[c].cbegin(); it!=work_blocks[c].cend(); ++it)
+      work[c][*it].clear();
+    work_blocks[c].clear();
+  }
+  for (auto it = cells_ind.cbegin(); it!=cells_ind.cend(); ++it)
+  {
+    std::vector<int>& block = work[ cell_color[*it] ][ cell_block[*it] ];
+    if ( block.empty() )
+      work_blocks[ cell_color[*it] ].push_back( cell_block[*it] );
+    block.push_back(*it);
+  }
+  // (2) Colour classes are visited in sequence, blocks of the same colour concurrently
+  for (std::size_t c = 0; c<work.size(); ++c)
+  {
+    const std::vector<int>& blocks = work_blocks[c];
+    int nb = blocks.size();
+    #pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b<nb; ++b)
     {
-      idx_p1 = density->iof(idx_cell1) + (int)( rng->sample_uniform() *
-        density->get_npc(i_cell1, j_cell1) );
-      idx_p1 = density->ind(idx_p1);
-      // (3) Select, at random, the unit k-vector
-      gen_scaled_k();
-      xk = ensemble->get_xp(idx_p1) - scaled_k[0];
-      yk = ensemble->get_yp(idx_p1) - scaled_k[1];
-      xkh = xk + scaled_k[0]/2.0;
-      ykh = yk + scaled_k[1]/2.0;
-      /* BOUNDARY CONDITIONS: we suppose periodic b.c. */
-      if ( xk <= xmin || xk >= xmax )
-      {
-        xk = xk - round( (xk-0.5*(xmax+xmin))/(xmax-xmin) ) * (xmax-xmin);
-        xkh = xkh - round( (xkh-0.5*(xmax+xmin))/(xmax-xmin) ) * (xmax-xmin);
-      }
-      if ( yk <= ymin || yk >= ymax )
-      {
-        yk = yk - round( (yk-0.5*(ymax+ymin))/(ymax-ymin) ) * (ymax-ymin);
-        ykh = ykh - round( (ykh-0.5*(ymax+ymin))/(ymax-ymin) ) * (ymax-ymin);
-      }
-      i_cell2 = (int)( (xk-xmin)*rdx );
-      j_cell2 = (int)( (yk-ymin)*rdy );
-      if( ( density->get_npc(i_cell2, j_cell2)>0 ) )
-      {
-        // (4) Select at random with equiprobability a particle in the cell where the k-vector points
-        idx_cell2 = grid->lexico(i_cell2, j_cell2);
-        idx_hcell2 = grid->lexico( (int)((xkh-xmin)*rdx), (int)((ykh-ymin)*rdy) );
-        idx = density->iof(idx_cell2) + (int)( rng->sample_uniform() * density->get_npc(i_cell2, j_cell2) );
-        idx_p2 = density->ind(idx);
-        rel_vel[0] = ensemble->get_vx(idx_p2) - ensemble->get_vx(idx_p1);
-        rel_vel[1] = ensemble->get_vy(idx_p2) - ensemble->get_vy(idx_p1);
-        rel_vel[2] = ensemble->get_vz(idx_p2) - ensemble->get_vz(idx_p1);
-        vr = sqrt( rel_vel[0]*rel_vel[0]+rel_vel[1]*rel_vel[1]+rel_vel[2]*rel_vel[2] );
-        vrmaxnew(i_cell1, j_cell1) = std::max( vrmaxnew(i_cell1, j_cell1), vr );
-        vrmaxnew(i_cell2, j_cell2) = std::max( vrmaxnew(i_cell2, j_cell2), vr );
-        scalar_prod = rel_vel[0]*scaled_k[0] + rel_vel[1]*scaled_k[1] + rel_vel[2]*scaled_k[2];
-        scalar_prod /= sigma;
-        aa = density->get_numdens(i_cell2, j_cell2) * correlation(
-          density->get_aveta(grid->lexico_inv(idx_hcell2).first, grid->lexico_inv(idx_hcell2).second) );
-        anew(i_cell1, j_cell1) = std::max( anew(i_cell1, j_cell1), aa );
-        anew(i_cell2, j_cell2) = std::max( anew(i_cell2, j_cell2),
-          density->get_numdens(i_cell1, j_cell1) * aa / density->get_numdens(i_cell2, j_cell2) );
-        if( a11(i_cell2, j_cell2) == 0.0 )
-          a11(i_cell2, j_cell2) = anew(i_cell2, j_cell2);
-        if( scalar_prod > 0.0 )
-        {
-          // vrmax11 HAS NOT BEEN UPDATED! WHY?
-          fk = scalar_prod * aa / ( a11(i_cell1, j_cell1) * vrmax11(i_cell1, j_cell1) );
-          if (fk > 1.0)
-            n_fake_idx++;
-          if ( rng->sample_uniform() < fk )
-          {
-            n_real++;
-            delta = scaled_k*scalar_prod/species->get_diam_fluid();
-            // delta = rel_vel*scalar_prod;
-            ensemble->get_vx(idx_p1) += delta[0];
-            ensemble->get_vy(idx_p1) += delta[1];
-            ensemble->get_vz(idx_p1) += delta[2];
-            ensemble->get_vx(idx_p2) -= delta[0];
-            ensemble->get_vy(idx_p2) -= delta[1];
-            ensemble->get_vz(idx_p2) -= delta[2];
-          }
-          else
-          {
-            n_fake++;
-          }
-          n_total++;
-        }
-      }
+      int t = ev_parallel::thread_id();
+      const std::vector<int>& cells = work[c][ blocks[b] ];
+      for (auto it = cells.cbegin(); it!=cells.cend(); ++it)
+        collide_cell(*it, t, thread_batch[t], thread_counters[t]);
     }
   }
+  for (auto it = thread_counters.cbegin(); it!=thread_counters.cend(); ++it)
+  {
+    n_fake += it->n_fake;
+    n_real += it->n_real;
+    n_total += it->n_total;
+    n_fake_idx += it->n_fake_idx;
+  }
+}
+
+void
+CollisionHandler::perform_collisions
+(void)
+{
+
+  // Set-up
+  compute_collision_number();
+  // Reset number of collisions
+  n_fake_idx = 0; n_fake = 0; n_real = 0; n_total = 0;
+  if ( split_type == SerialSplit )
+    perform_collisions_serial();
+  else
+    perform_collisions_colored();
   // Display statistics
   std::cout << "collisions performed" << std::endl;
   std::cout << "total = " << n_total << "\t real = " << n_real << "\t fake = " << n_fake << "\t out-range = " << n_fake_idx << std::endl;
@@ -229,6 +510,7 @@ CollisionHandler::perform_collisions
   n_real_store.push_back(n_real);
   n_total_store.push_back(n_total);
   n_out_store.push_back(n_fake_idx);
+  n_collision_steps++;
 
   update_majorants();
 
@@ -238,6 +520,17 @@ void
 CollisionHandler::update_majorants
 (void)
 {
+  cand_cell_tot += cand_cell;
+  real_cell_tot += real_cell;
+  over_cell_tot += over_cell;
+  if ( PER_CELL_MAJORANTS )
+  {
+    update_majorants_cell();
+    return;
+  }
+  cand_cell.fill(0);
+  real_cell.fill(0);
+  over_cell.fill(0);
   if ( (double)n_fake_idx > alpha_1*(double)n_real )
   {
     a11 = anew;
@@ -257,6 +550,44 @@ CollisionHandler::update_majorants
   */
 }
 
+void
+CollisionHandler::update_majorants_cell
+(void)
+{
+  int nx = grid->get_n_cells_x(), ny = grid->get_n_cells_y();
+  #pragma omp parallel for schedule(static)
+  for (int i = 0; i<nx; ++i)
+  {
+    for (int j = 0; j<ny; ++j)
+    {
+      // (1) Majorant never estimated or exceeded: restore running maxima
+      if ( a11(i,j) == 0.0 || vrmax11(i,j) == 0.0 )
+      {
+        a11(i,j) = anew(i,j);
+        vrmax11(i,j) = vrmaxnew(i,j);
+        continue;
+      }
+      else if ( over_cell(i,j) > 0 && (double)over_cell(i,j) > alpha_1*(double)real_cell(i,j) )
+      {
+        a11(i,j) = anew(i,j);
+        vrmax11(i,j) = vrmaxnew(i,j);
+      }
+      // (2) Window not yet complete: wait
+      else if ( cand_cell(i,j) < min_candidates )
+        continue;
+      // (3) Too many fake collisions: lower majorants
+      else if ( (double)real_cell(i,j) < target_acceptance*(double)cand_cell(i,j) )
+      {
+        a11(i,j) *= alpha_2;
+        vrmax11(i,j) *= alpha_2;
+      }
+      cand_cell(i,j) = 0;
+      real_cell(i,j) = 0;
+      over_cell(i,j) = 0;
+    }
+  }
+}
+
 void
 CollisionHandler::perform_collision_kernel
 (void)
@@ -265,3 +596,75 @@ CollisionHandler::perform_collision_kernel
   compute_collision_number();
   perform_collisions();
 }
+
+void
+CollisionHandler::save_checkpoint
+(ev_checkpoint::CheckpointWriter& checkpoint) const
+{
+  checkpoint.section("collisions");
+  checkpoint.put<int32_t>(n_fake);
+  checkpoint.put<int32_t>(n_real);
+  checkpoint.put<int32_t>(n_total);
+  checkpoint.put<int32_t>(n_fake_idx);
+  checkpoint.put_vector(n_fake_store);
+  checkpoint.put_vector(n_real_store);
+  checkpoint.put_vector(n_total_store);
+  checkpoint.put_vector(n_out_store);
+  checkpoint.put_array(a11);
+  checkpoint.put_array(vrmax11);
+  checkpoint.put_array(anew);
+  checkpoint.put_array(vrmaxnew);
+  checkpoint.put_array(cand_cell);
+  checkpoint.put_array(real_cell);
+  checkpoint.put_array(over_cell);
+  checkpoint.put_array(cand_cell_tot);
+  checkpoint.put_array(real_cell_tot);
+  checkpoint.put_array(over_cell_tot);
+  // Random streams
+  checkpoint.put<uint32_t>(n_collision_steps);
+  checkpoint.put<uint32_t>(n_majorant_steps);
+  counter_rng.save_state(checkpoint.stream());
+  checkpoint.put<int32_t>(thread_rng.size());
+  for (auto it = thread_rng.cbegin(); it!=thread_rng.cend(); ++it)
+    (*it)->save_state(checkpoint.stream());
+}
+
+void
+CollisionHandler::load_checkpoint
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  checkpoint.expect_section("collisions");
+  checkpoint.get(n_fake);
+  checkpoint.get(n_real);
+  checkpoint.get(n_total);
+  checkpoint.get(n_fake_idx);
+  checkpoint.get_vector(n_fake_store);
+  checkpoint.get_vector(n_real_store);
+  checkpoint.get_vector(n_total_store);
+  checkpoint.get_vector(n_out_store);
+  checkpoint.get_array(a11);
+  checkpoint.get_array(vrmax11);
+  checkpoint.get_array(anew);
+  checkpoint.get_array(vrmaxnew);
+  checkpoint.get_array(cand_cell);
+  checkpoint.get_array(real_cell);
+  checkpoint.get_array(over_cell);
+  checkpoint.get_array(cand_cell_tot);
+  checkpoint.get_array(real_cell_tot);
+  checkpoint.get_array(over_cell_tot);
+  checkpoint.get(n_collision_steps);
+  checkpoint.get(n_majorant_steps);
+  counter_rng.load_state(checkpoint.stream());
+  int nt = checkpoint.get<int32_t>();
+  if ( nt != ev_parallel::max_threads() )
+    std::cout << " >> restart: checkpoint saved with " << nt << " threads, running with "
+      << ev_parallel::max_threads() << " (the continuation will differ)" << std::endl;
+  thread_rng.clear();
+  for (int t = 0; t<nt; ++t)
+  {
+    thread_rng.push_back( DefaultPointer<RandomEngine>( new RandomEngine(1) ) );
+    thread_rng.back()->load_state(checkpoint.stream());
+  }
+  thread_counters.assign( nt, CollisionCounters() );
+  thread_batch.resize( nt );
+}
@@ -8,10 +8,9 @@
 #include "motherbase.hpp"
 #include "matrix.hpp"
 #include "utility.hpp"
+#include "parallel.hpp"
+#include "density.hpp"
 
-/* Valarray turns out to be handy when dealing to fixed-dimension array behaving
-    like mathematical vectors */
-#include <valarray>
 #include <cmath>
 #include <algorithm>
 #include <vector>
@@ -37,6 +36,35 @@
 #define DEFAULT_ALPHA_2 0.99
 #endif
 
+/*! \def PER_CELL_MAJORANTS
+    \brief If 1 each cell adapts its own majorants, if 0 majorants are controlled by global counts
+*/
+#ifndef PER_CELL_MAJORANTS
+#define PER_CELL_MAJORANTS 1
+#endif
+
+/*! \def DEFAULT_TARGET_ACCEPTANCE
+    \brief Real/candidate ratio below which the majorants of a cell are lowered
+*/
+#ifndef DEFAULT_TARGET_ACCEPTANCE
+#define DEFAULT_TARGET_ACCEPTANCE 0.3
+#endif
+
+/*! \def DEFAULT_MIN_CANDIDATES
+    \brief Number of candidates a cell has to gather before its acceptance ratio is trusted
+*/
+#ifndef DEFAULT_MIN_CANDIDATES
+#define DEFAULT_MIN_CANDIDATES 20
+#endif
+
+/*! \def COUNTER_BASED_RNG
+    \brief If 1 the numbers of each cell are drawn from a Philox substream (step, cell), so that
+           results do not depend on the number of threads; if 0 each thread has its own engine
+*/
+#ifndef COUNTER_BASED_RNG
+#define COUNTER_BASED_RNG 1
+#endif
+
 // The macros below are unused:
 /* #ifndef DEFAULT_ALPHA_3
    #define DEFAULT_ALPHA_3 1e2
@@ -45,6 +73,156 @@
    #define DEFAULT_ALPHA_4 0.99
    #endif */
 
+/*! \enum SplitType
+ *  \brief Partitioning strategies for the collision stage ('split_type' in the conf. file)
+ *
+ *  Cells closer than the collision reach (sigma) share particles and majorants,
+ *  hence they must never be processed concurrently: cells are grouped in colour
+ *  classes whose members are far enough from each other to be run in parallel
+ */
+enum SplitType
+{
+  SerialSplit = 0,    /*!< Random permutation of all cells, single stream       */
+  BlockSplit = 1,     /*!< Checkerboard (2x2 colours) of blocks wider than 2*sigma  */
+  StrideSplit = 2     /*!< Cells coloured by index modulo a stride wider than 2*sigma */
+};
+
+/*! \enum CollisionScheme
+ *  \brief Algorithms drawing the number of candidates ('routine_choice' in the conf. file)
+ */
+enum CollisionScheme
+{
+  PoissonScheme = 1,    /*!< Exact Poisson no. of candidates (reference, not faster) */
+  MajorantScheme = 2    /*!< Majorant frequency, Bernoulli rounding                  */
+};
+
+/*! \class AbstractCollisionRoutine
+ *  \brief Interface for the algorithms drawing the number of candidates of a cell
+ *
+ *  Given the expected number of candidates from the majorants, a routine returns
+ *  the number of candidates actually simulated, whose mean must be the expected
+ *  number: candidates are accepted with the plain majorant probability, which
+ *  can not be scaled up without exceeding 1 (i.e. without biasing collisions)
+ */
+class AbstractCollisionRoutine
+{
+public:
+  typedef DSMC::RandomEngine RandomEngine;
+  AbstractCollisionRoutine() = default;
+  virtual ~AbstractCollisionRoutine() = default;
+  virtual int draw_candidates(real_number expected, RandomEngine& engine) = 0;
+  virtual const char* name(void) const = 0;
+};
+
+/*! \class CollisionRoutine
+ *  \brief Base for collision routines hierarchy
+ *
+ *  This template class needs to be specialized in order to produce a valid routine
+ */
+template <CollisionScheme dummy_scheme>
+class CollisionRoutine : public AbstractCollisionRoutine
+{
+public:
+  CollisionRoutine()
+    {
+      throw "Invalid specification for CollisionRoutine template";
+    }
+  ~CollisionRoutine() = default;
+};
+
+/*! \class CollisionRoutine<MajorantScheme>
+ *  \brief Standard majorant-frequency scheme
+ *
+ *  The expected number of candidates is rounded up or down with a Bernoulli trial
+ */
+template <>
+class CollisionRoutine<MajorantScheme> : public AbstractCollisionRoutine
+{
+public:
+  CollisionRoutine() = default;
+  ~CollisionRoutine() = default;
+  virtual int draw_candidates(real_number expected, RandomEngine& engine) override
+  {
+    int n = (int)expected;
+    if ( engine.sample_uniform() < expected - n ) n++;
+    return n;
+  }
+  virtual const char* name(void) const override { return "majorant"; }
+};
+
+/*! \class CollisionRoutine<PoissonScheme>
+ *  \brief Majorant-frequency scheme with an exact Poisson number of candidates
+ *
+ *  Reference routine, not a speed option: the mean number of candidates is the
+ *  same as with MajorantScheme, but each cell costs a Poisson inversion (over
+ *  about 24 standard deviations of the distribution) and the count has a larger
+ *  variance than with Bernoulli rounding. Useful to check that results do not
+ *  depend on how the expected number of candidates is rounded
+ */
+template <>
+class CollisionRoutine<PoissonScheme> : public AbstractCollisionRoutine
+{
+public:
+  CollisionRoutine() = default;
+  ~CollisionRoutine() = default;
+  virtual int draw_candidates(real_number expected, RandomEngine& engine) override
+  {
+    if ( expected <= 0.0 )
+      return 0;
+    const real_number u = engine.sample_uniform();
+    // Inversion over the masses within about 12 standard deviations from the mean
+    // (the rest is negligible)
+    const real_number spread = 12.0*sqrt(expected) + 12.0;
+    const int k_max = (int)( expected + spread );
+    int k = std::max( 0, (int)( expected - spread ) );
+    real_number p_k = exp( k*log(expected) - expected - lgamma(k+1.0) );
+    real_number cdf = p_k;
+    while ( u >= cdf && k < k_max )
+    {
+      k++;
+      p_k *= expected / k;
+      cdf += p_k;
+    }
+    return k;
+  }
+  virtual const char* name(void) const override { return "poisson"; }
+};
+
+/*! \struct CollisionCounters
+ *  \brief Collision counters, to be accumulated separately by each thread
+ */
+struct CollisionCounters
+{
+  int n_fake = 0;       /*!< Number of false collisions                 */
+  int n_real = 0;       /*!< Number of true collisions                  */
+  int n_total = 0;      /*!< Total number  collisions                   */
+  int n_fake_idx = 0;   /*!< True collisions for which probability > 1  */
+};
+
+/*! \struct CandidateBatch
+ *  \brief Scratch buffers holding all candidate collisions of a cell
+ *
+ *  Random numbers are drawn for the whole cell at once, then k-vectors and target
+ *  cells are computed in plain loops over the arrays; buffers only grow, hence
+ *  no allocation takes place once the largest cell has been processed
+ */
+struct CandidateBatch
+{
+  std::vector<real_number> rnd;             /*!< Uniforms (5 for each candidate, stored by blocks)  */
+  std::vector<real_number> kx, ky, kz;      /*!< Scaled k-vectors (sigma*k)                         */
+  std::vector<int> p1;                      /*!< First particle of each candidate                   */
+  std::vector<int> c2;                      /*!< Target cell of each candidate (-1 if none)         */
+  std::vector<int> ch;                      /*!< Cell containing the contact point                  */
+  void reserve(int n)
+  {
+    if ( (int)p1.size() >= n ) return;
+    rnd.resize(5*n);
+    kx.resize(n); ky.resize(n); kz.resize(n);
+    p1.resize(n);
+    c2.resize(n); ch.resize(n);
+  }
+};
+
 // NB: the variable names used in this class are not at all intuitive (more
 //     meaningful names may be employed).
 
@@ -57,6 +235,9 @@
 class CollisionHandler : protected Motherbase
 {
 
+public:
+  typedef ev_random::CustomRngObject<ev_random::Philox> CounterEngine;
+
 private:
 
   // Global number of collisions
@@ -82,29 +263,55 @@ private:
   // UNUSED
   // ev_matrix::MaskMatrix<real_number> freq11;
 
+  // Per-cell counters (first particle's cell), over the current adaptation window
+  ev_matrix::MaskMatrix<int> cand_cell;     /*!< Candidate collisions           */
+  ev_matrix::MaskMatrix<int> real_cell;     /*!< Accepted collisions            */
+  ev_matrix::MaskMatrix<int> over_cell;     /*!< Collisions with probability > 1 */
+
+  // Per-cell counters, cumulated over the whole run (telemetry)
+  ev_matrix::MaskMatrix<int> cand_cell_tot;   /*!< Candidate collisions           */
+  ev_matrix::MaskMatrix<int> real_cell_tot;   /*!< Accepted collisions            */
+  ev_matrix::MaskMatrix<int> over_cell_tot;   /*!< Collisions with probability > 1 */
+
   int n_coll;                               /*!< Total number of collisions         */
   ev_matrix::MaskMatrix<int> n_coll_cell;   /*!< Number of collisions for each cell */
 
-  std::valarray<real_number> scaled_k;      /*!< Scaled vector pointing to target cell (sigma*k)  */
-  std::valarray<real_number> rel_vel;       /*!< Relative velocity between particles              */
-  std::valarray<real_number> delta;         /*!< Vector to be added/subtracted to update velocity */
+  // Algorithm drawing the number of candidates (see CollisionScheme)
+  int routine_choice;
+  DefaultPointer<AbstractCollisionRoutine> routine;
 
-  /*! \fn void CollisionHandler::gen_scaled_k(void)
+  /*! \fn void CollisionHandler::gen_scaled_k(ev_random::RngAbstract&, real_number&, real_number&, real_number&)
       \brief Creates the vector poiting to the cell jc2 (scaled by sigma)
   */
-  inline void gen_scaled_k(void)
+  inline void gen_scaled_k(ev_random::RngAbstract& engine, real_number& kx, real_number& ky, real_number& kz)
   {
-    rng->sample_unit_sphere(scaled_k[0], scaled_k[1], scaled_k[2]);
-    scaled_k *= species->get_diam_fluid();
+    engine.sample_unit_sphere(kx, ky, kz);
+    kx *= sigma;
+    ky *= sigma;
+    kz *= sigma;
   }
 
   // Utilities
-  real_number vr = 0.0, scalar_prod = 0.0;
-  std::vector<int> cells_ind;
+  std::vector<int> cells_ind;     /*!< Cells having candidates at the current step (lexico index) */
+
+  // Parallel collision stage
+  int split_type;                                           /*!< Partitioning strategy (see SplitType)    */
+  std::vector< std::vector< std::vector<int> > > colors;    /*!< Colour classes -> blocks -> cells        */
+  std::vector< std::vector< std::vector<int> > > work;      /*!< Same as colors, cells with candidates only */
+  std::vector< std::vector<int> > work_blocks;              /*!< Non-empty blocks of work, for each colour  */
+  std::vector<int> cell_color, cell_block;                  /*!< Colour and block of each cell            */
+  std::vector< DefaultPointer<RandomEngine> > thread_rng;   /*!< One random stream for each thread        */
+  CounterEngine counter_rng;                                /*!< Counter-based engine (see COUNTER_BASED_RNG) */
+  uint32_t n_collision_steps = 0;                           /*!< Collision steps drawn from counter_rng   */
+  uint32_t n_majorant_steps = 0;                            /*!< Majorant estimates drawn from counter_rng */
+  std::vector<CollisionCounters> thread_counters;           /*!< Collision counters for each thread       */
+  std::vector<CandidateBatch> thread_batch;                 /*!< Candidates scratch for each thread       */
 
   // Controlling number of collisions
   const real_number alpha_1 = DEFAULT_ALPHA_1;  /*!< First coefficient for collision number control   */
   const real_number alpha_2 = DEFAULT_ALPHA_2;  /*!< Second coefficient for collision number control  */
+  const real_number target_acceptance = DEFAULT_TARGET_ACCEPTANCE;  /*!< Target real/candidate ratio  */
+  const int min_candidates = DEFAULT_MIN_CANDIDATES;                /*!< Minimum window for a cell    */
 
   // UNUSED
   // const real_number alpha_3 = DEFAULT_ALPHA_3;
@@ -112,23 +319,81 @@ private:
 
   /*! \fn void CollisionHandler::update_majorants(void)
       \brief Updates majorants according to the predefined coefficients alpha_1, alpha_1
+
+      Dispatches to the global or to the per-cell control (see PER_CELL_MAJORANTS)
   */
   void update_majorants(void);
 
+  /*! \fn void CollisionHandler::update_majorants_cell(void)
+      \brief Per-cell majorant control
+
+      Once a cell has gathered enough candidates (or as soon as it records
+      out-of-bound collisions) its majorants are reset to the running maxima if
+      over_cell > alpha_1*real_cell, otherwise they are lowered by alpha_2 as long
+      as the acceptance ratio stays below the target; then its window is cleared
+  */
+  void update_majorants_cell(void);
+
   // References from other classes
   const int& npart;
   const int& nx, ny;
   const real_number& xmin, xmax, ymin, ymax;
   const real_number& rdx, rdy;
   const real_number& sigma, delta_t;
+  const int chi_ref;                  /*!< Refinement of the contact-point grid (see DensityKernel) */
+  const int n_halo_x, n_halo_y;       /*!< Width of the ghost layer (see DensityKernel)             */
+
+  /*! \fn int CollisionHandler::owner_cell(real_number, real_number) const
+      \brief Returns the lexico index of the cell owning the point (x,y), within one diameter of the domain (-1 if none)
+  */
+  inline int owner_cell(real_number x, real_number y) const
+  {
+    // Shifting by the ghost layer keeps the argument positive: truncation is a floor
+    return density->get_halo_cell(
+      (int)( (x-xmin)*rdx + n_halo_x ) - n_halo_x,
+      (int)( (y-ymin)*rdy + n_halo_y ) - n_halo_y );
+  }
+
+  /*! \fn int CollisionHandler::owner_contact(real_number, real_number) const
+      \brief Returns the lexico index of the contact-point cell owning the point (x,y) (-1 if none)
+  */
+  inline int owner_contact(real_number x, real_number y) const
+  {
+    return density->get_halo_contact(
+      (int)( (x-xmin)*rdx*chi_ref + chi_ref*n_halo_x ) - chi_ref*n_halo_x,
+      (int)( (y-ymin)*rdy*chi_ref + chi_ref*n_halo_y ) - chi_ref*n_halo_y );
+  }
 
-  /*! \fn void CollisionHandler::setup_cell_ind(void)
-      \brief Set-up the vector containing the index for each cell
 
-      Cells indices are randomly selected from this array; once the cell is selected
-      the index is erased from the array
+  /*! \fn void CollisionHandler::setup_colors(void)
+      \brief Partitions cells into colour classes according to the split type
+
+      Two cells belonging to different blocks of the same colour are more than two
+      collision reaches apart, i.e. they never share target cells nor particles
+  */
+  void setup_colors(void);
+
+  /*! \fn void CollisionHandler::setup_thread_rng(void)
+      \brief Seeds one random stream for each thread, drawing seeds from the main RNG
+             (from a dedicated Philox stream if COUNTER_BASED_RNG)
   */
-  void setup_cell_ind(void);
+  void setup_thread_rng(void);
+
+  /*! \fn void CollisionHandler::collide_cell(int, Engine&, CandidateBatch&, CollisionCounters&)
+      \brief Simulates all candidate collisions having the first particle in the given cell
+  */
+  template <class Engine>
+  void collide_cell(int, Engine&, CandidateBatch&, CollisionCounters&);
+
+  /*! \fn void CollisionHandler::collide_cell(int, int, CandidateBatch&, CollisionCounters&)
+      \brief Simulates the collisions of a cell drawing from the engine of the given thread, or
+             from the substream of the cell if COUNTER_BASED_RNG
+  */
+  void collide_cell(int, int, CandidateBatch&, CollisionCounters&);
+
+  // Serial (random permutation) and coloured (thread-parallel) collision sweeps
+  void perform_collisions_serial(void);
+  void perform_collisions_colored(void);
 
 public:
 
@@ -143,6 +408,21 @@ public:
   // Collisional stage in a packet
   void perform_collision_kernel(void);
 
+  /*! \fn void CollisionHandler::set_routine(int)
+      \brief Selects the algorithm drawing the number of candidates (see CollisionScheme)
+  */
+  void set_routine(int);
+
+  /*! \fn void CollisionHandler::save_checkpoint(ev_checkpoint::CheckpointWriter&) const
+      \brief Writes majorants, collision windows and statistics, and the state of all random streams
+  */
+  void save_checkpoint(ev_checkpoint::CheckpointWriter&) const;
+
+  /*! \fn void CollisionHandler::load_checkpoint(ev_checkpoint::CheckpointReader&)
+      \brief Restores the state written by save_checkpoint (replaces compute_majorants)
+  */
+  void load_checkpoint(ev_checkpoint::CheckpointReader&);
+
   // GETTERS
   inline int get_n_fake(void) const { return n_fake; }
   inline int get_n_real(void) const { return n_real; }
@@ -151,6 +431,13 @@ public:
   inline const ev_matrix::MaskMatrix<real_number>& get_a11(void) const { return a11; }
   inline const ev_matrix::MaskMatrix<real_number>& get_vrmax11(void) const { return vrmax11; }
   inline const ev_matrix::MaskMatrix<int>& get_n_coll_cell(void) const { return n_coll_cell; }
+  inline const ev_matrix::MaskMatrix<int>& get_cand_cell_tot(void) const { return cand_cell_tot; }
+  inline const ev_matrix::MaskMatrix<int>& get_real_cell_tot(void) const { return real_cell_tot; }
+  inline const ev_matrix::MaskMatrix<int>& get_over_cell_tot(void) const { return over_cell_tot; }
+  inline int get_split_type(void) const { return split_type; }
+  inline int get_n_colors(void) const { return colors.size(); }
+  inline int get_routine_choice(void) const { return routine_choice; }
+  inline const char* get_routine_name(void) const { return routine->name(); }
   inline std::vector<int>& get_n_fake_store(void) { return n_fake_store; }
   inline const std::vector<int>& get_n_fake_store(void) const { return n_fake_store; }
   inline std::vector<int>& get_n_real_store(void) { return n_real_store; }
@@ -98,7 +98,7 @@ private:
   int n_cells_y;                            /*!< Number of cells in y-direction                     */
   int n_part;                               /*!< Number of particles                                */
   bool mean_vel;                            /*!< Fix mean velocity (UNUSED)                         */
-  bool restart;                             /*!< Restart from previous configuration (UNUSED)       */
+  int restart;                              /*!< Restart: 0 no, 1 from checkpoint, 2 mirrored       */
   real_number vx_ini;                       /*!< Prescribed initial velocity in x-direction         */
   real_number vy_ini;                       /*!< Prescribed initial velocity in y-direction         */
   real_number vz_ini;                       /*!< Prescribed initial velocity in z-direction         */
@@ -110,12 +110,12 @@ private:
   real_number delta_t;                      /*!< Time step                                          */
   int qwrite;                               /*!< Tag for writing macro quantities (UNUSED)          */
   int seed;                                 /*!< Seed for RNG                                       */
-  int Nv;                                   /*!< Number of nodes for velocity distribution (UNUSED) */
-  int routine_choice;                       /*!< Routine for collisions computation (UNUSED)        */
-  int split_type;                           /*!< Routine for parallel collisions (UNUSED)           */
+  int Nv;                                   /*!< Number of nodes for velocity distribution          */
+  int routine_choice;                       /*!< Routine for collisions computation                 */
+  int split_type;                           /*!< Routine for parallel collisions                    */
   char c_med_comp_type;                     /*!< Routine for mean-field kernel computation (UNUSED) */
   bool collstat;                            /*!< Output (1) or not (0) collisions statistics        */
-  int ndom;                                 /*!< Number of subdom. for stat. aggregation (UNUSED)   */
+  int ndom;                                 /*!< Number of subdom. for stat. aggregation            */
   int niter_sampling;                       /*!< Number of sampling iterations                      */
 
   // DERIVED PARAMETERS
@@ -165,6 +165,10 @@ public:
   inline int get_L_y_2() const { return L_y_2; }
   inline const std::array<char, 4>& get_wall_cond() const { return wall_cond; }
   inline const std::array<real_number, 4>& get_p_e() const { return p_e; }
+  inline const std::array<real_number, 4>& get_T_w() const { return T_w; }
+  inline const std::array<real_number, 4>& get_U_wx() const { return U_wx; }
+  inline const std::array<real_number, 4>& get_U_wy() const { return U_wy; }
+  inline real_number get_eta_w1() const { return eta_w1; }
 
   inline int get_liq_interf() const { return liq_interf; }
   inline real_number get_x_liq_interf() const { return x_liq_interf; }
@@ -198,8 +202,13 @@ public:
   inline real_number get_t_im() const { return t_im; }
   inline real_number get_delta_t() const { return delta_t; }
 
+  inline int get_split_type() const { return split_type; }
+  inline int get_routine_choice() const { return routine_choice; }
+
   inline int get_niter_thermo() const { return niter_thermo; }
   inline int get_niter_sampling() const { return niter_sampling; }
+  inline int get_Nv() const { return Nv; }
+  inline int get_ndom() const { return ndom; }
   inline real_number get_T_ref() const { return T_ref; }
   inline real_number get_T_ini() const { return T_ini; }
 
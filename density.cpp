@@ -3,6 +3,9 @@
 #include "species.hpp"
 #include "particles.hpp"
 #include "configuration.hpp"
+#include "boundary.hpp"
+
+#include "checkpoint.hpp"
 
 // DEBUG
 // # # # # #
@@ -34,10 +37,18 @@ DensityKernel::DensityKernel
     n_cutoff_x, n_cutoff_y ),
   average_reduced_density( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
   avg_convolutioner( average_reduced_density, weights, reduced_density, 0.0 ),
+  chi_ref( STAGGERED_CHI ? 2 : 1 ),
+  chi_contact( 0, chi_ref*grid->get_n_cells_x(), 0, chi_ref*grid->get_n_cells_y(), 0.0 ),
   idx_cell( ensemble->get_n_particles(), 0 ),
   idx_map( ensemble->get_n_particles(), 0 ),
   cum_num( grid->get_n_cells()+1, 0 ),
-  raw_num( grid->get_n_cells(), 0 )
+  raw_num( grid->get_n_cells(), 0 ),
+  active_cells(),
+  n_halo_x( (int)( species->get_diam_fluid() / grid->get_dx() ) + 1 ),
+  n_halo_y( (int)( species->get_diam_fluid() / grid->get_dy() ) + 1 ),
+  halo_cell( -n_halo_x, grid->get_n_cells_x()+n_halo_x, -n_halo_y, grid->get_n_cells_y()+n_halo_y, -1 ),
+  halo_contact( -chi_ref*n_halo_x, chi_ref*(grid->get_n_cells_x()+n_halo_x),
+    -chi_ref*n_halo_y, chi_ref*(grid->get_n_cells_y()+n_halo_y), -1 )
   {
 
     // Initialize weights
@@ -66,9 +77,36 @@ DensityKernel::DensityKernel
     weights /= sum_w;
     std::cout << "### COMPUTING PARTICLE MAP ###" << std::endl;
     compute_ind_map_part();
+    std::cout << "### SETTING-UP GHOST CELLS ###" << std::endl;
+    setup_halo_map();
 
   }
 
+void
+DensityKernel::setup_halo_map
+(void)
+{
+  const std::array<char, 4>& wall_condition = boundary->get_wall_condition();
+  // Edges: 0 = x1, 1 = y1, 2 = x2, 3 = y2 (see Boundary)
+  auto owner = [&wall_condition] (int i, int j, int n_x, int n_y)
+  {
+    if ( ( i < 0 && wall_condition[0] != 'p' ) || ( i >= n_x && wall_condition[2] != 'p' )
+      || ( j < 0 && wall_condition[1] != 'p' ) || ( j >= n_y && wall_condition[3] != 'p' ) )
+      return -1;
+    i = ( i % n_x + n_x ) % n_x;
+    j = ( j % n_y + n_y ) % n_y;
+    return i + j*n_x;
+  };
+  int nx = grid->get_n_cells_x(), ny = grid->get_n_cells_y();
+  for (int i = halo_cell.get_lx(); i<halo_cell.get_ux(); ++i)
+    for (int j = halo_cell.get_ly(); j<halo_cell.get_uy(); ++j)
+      halo_cell(i,j) = owner(i, j, nx, ny);
+  for (int i = halo_contact.get_lx(); i<halo_contact.get_ux(); ++i)
+    for (int j = halo_contact.get_ly(); j<halo_contact.get_uy(); ++j)
+      halo_contact(i,j) = owner(i, j, chi_ref*nx, chi_ref*ny);
+  std::cout << " >> ghost layer = " << n_halo_x << " x " << n_halo_y << " cells" << std::endl;
+}
+
 void
 DensityKernel::binning
 (void)
@@ -87,8 +125,18 @@ DensityKernel::binning
   // Setting cumulate density
   int NC = grid->get_n_cells();
   cum_num.assign(NC+1, 0);
+  active_cells.clear();
   for (int k = 1; k<NC+1; ++k)
+  {
     cum_num[k] = cum_num[k-1] + n_part_cell(grid->lexico_inv(k-1).first, grid->lexico_inv(k-1).second);
+    if ( cum_num[k] > cum_num[k-1] )
+      active_cells.push_back(k-1);
+  }
+  // Particles-cell map has to follow particles (collisions rely on it)
+  compute_ind_map_part();
+  if ( sort_period > 0 && n_binning % sort_period == 0 )
+    sort_ensemble();
+  n_binning++;
 }
 
 void
@@ -108,6 +156,26 @@ DensityKernel::compute_ind_map_part
   }
 }
 
+/*! \fn void DensityKernel::sort_ensemble(void)
+    \brief Stores particles in the order of the particles-cell map, which becomes the identity
+*/
+void
+DensityKernel::sort_ensemble
+(void)
+{
+  int NP = ensemble->get_n_particles();
+  std::vector<Particle>& particles = ensemble->data();
+  sort_buffer.resize(NP);
+  for (int k = 0; k<NP; ++k)
+    sort_buffer[k] = particles[idx_map[k]];
+  particles.swap(sort_buffer);
+  for (int k = 0; k<NP; ++k)
+  {
+    idx_map[k] = k;
+    idx_cell[k] = grid->lexico( particles[k].cell_x, particles[k].cell_y );
+  }
+}
+
 void
 DensityKernel::fill_dummy_field
 (void)
@@ -135,6 +203,46 @@ DensityKernel::compute_avg_density
   avg_convolutioner.convolute();
 }
 
+void
+DensityKernel::compute_correlation
+(void)
+{
+  int nx = grid->get_n_cells_x(), ny = grid->get_n_cells_y();
+  if ( chi_ref == 1 )
+  {
+    for (int i = 0; i<nx; ++i)
+      for (int j = 0; j<ny; ++j)
+        chi_contact(i,j) = correlation( average_reduced_density(i,j) );
+    return;
+  }
+  // Half-cell centres lie a quarter of cell away from the cell centre: bilinear
+  // weights 3/4 (own cell) and 1/4 (neighbour); the neighbour wraps around periodic
+  // edges, while at other edges it is the mirror image of the own cell
+  const std::array<char, 4>& wall_condition = boundary->get_wall_condition();
+  auto neighbour = [&wall_condition] (int i, int n, int side)
+  {
+    if ( i < 0 )
+      return wall_condition[side] == 'p' ? n-1 : 0;
+    if ( i >= n )
+      return wall_condition[side+2] == 'p' ? 0 : n-1;
+    return i;
+  };
+  int i0, j0, i1, j1;
+  for (int p = 0; p<2*nx; ++p)
+  {
+    i0 = p/2;
+    i1 = neighbour( ( p%2==0 ) ? i0-1 : i0+1, nx, 0 );
+    for (int q = 0; q<2*ny; ++q)
+    {
+      j0 = q/2;
+      j1 = neighbour( ( q%2==0 ) ? j0-1 : j0+1, ny, 1 );
+      chi_contact(p,q) = correlation(
+          0.5625 * average_reduced_density(i0,j0) + 0.1875 * average_reduced_density(i1,j0)
+        + 0.1875 * average_reduced_density(i0,j1) + 0.0625 * average_reduced_density(i1,j1) );
+    }
+  }
+}
+
 void
 DensityKernel::perform_density_kernel
 (void)
@@ -143,6 +251,7 @@ DensityKernel::perform_density_kernel
   fill_dummy_field();
   compute_reduced_density();
   compute_avg_density();
+  compute_correlation();
   // DEBUG
   // # # # # #
   // print_binned_particles();
@@ -151,6 +260,23 @@ DensityKernel::perform_density_kernel
   // # # # # #
 }
 
+void
+DensityKernel::save_checkpoint
+(ev_checkpoint::CheckpointWriter& checkpoint) const
+{
+  checkpoint.section("density");
+  checkpoint.put<int32_t>(n_binning);
+}
+
+void
+DensityKernel::load_checkpoint
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  checkpoint.expect_section("density");
+  n_binning = checkpoint.get<int32_t>() - 1;
+  perform_density_kernel();
+}
+
 // TESTING
 void
 DensityKernel::print_binned_particles
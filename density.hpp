@@ -9,9 +9,24 @@
 #include "types.hpp"
 #include "utility.hpp"
 #include "motherbase.hpp"
+#include "particles.hpp"
 
 #include <cmath>
 
+/*! \def STAGGERED_CHI
+    \brief Evaluate the correlation function on a half-cell (staggered) grid (1) or per cell (0)
+*/
+#ifndef STAGGERED_CHI
+#define STAGGERED_CHI 0
+#endif
+
+/*! \def DEFAULT_SORT_PERIOD
+    \brief Number of binnings between two reorderings of the ensemble by cell (0: never)
+*/
+#ifndef DEFAULT_SORT_PERIOD
+#define DEFAULT_SORT_PERIOD 10
+#endif
+
 /*! \class DensityKernel
  *  \brief Class for density and reduced density computation
  *
@@ -46,6 +61,16 @@ private:
 
   ev_matrix::MatrixConvolutioner<real_number> avg_convolutioner;  /*!< Convolutioner computing averaged density     */
 
+  // CORRELATION FIELDS
+  /*!
+   *  The correlation function is evaluated once per step on the averaged reduced
+   *  density, so that collisions only need to load values; the contact-point grid
+   *  is either the cell grid or a grid refined by 2 in each direction, whose values
+   *  are obtained interpolating the averaged density at the half-cell centres.
+   */
+  int chi_ref;                                                    /*!< Refinement of the contact-point grid (1 or 2)  */
+  ev_matrix::MaskMatrix<real_number> chi_contact;                 /*!< Correlation function on the contact-point grid */
+
   // PARTICLES-CELL MAP BUFFERS
   /*!
    *  DensityKernel class defines maps to locate particles. They are obtained by
@@ -53,8 +78,39 @@ private:
    */
   std::vector<int> idx_cell, idx_map, cum_num, raw_num;
 
+  // ACTIVE CELLS
+  /*!
+   *  Cells holding at least one particle, in lexico-graphic order; rebuilt at each
+   *  binning, so that per-cell loops can skip empty (e.g. dilute gas) cells.
+   */
+  std::vector<int> active_cells;
   void compute_ind_map_part(void);
 
+  // CELL-ORDERED STORAGE
+  /*!
+   *  Every sort_period binnings particles are stored in the order of the
+   *  particles-cell map, so that the particles of a cell are contiguous in memory
+   *  and per-cell loops (collisions, sampling) read the ensemble sequentially;
+   *  particles move less than a cell per step, hence the order decays slowly.
+   */
+  const int sort_period = DEFAULT_SORT_PERIOD;
+  int n_binning = 0;
+  std::vector<Particle> sort_buffer;
+  void sort_ensemble(void);
+
+  // GHOST CELLS
+  /*!
+   *  A layer of ghost cells, one diameter wide, surrounds the domain: each ghost
+   *  cell stores the lexico index of the cell owning it (its periodic image), or
+   *  -1 behind non-periodic edges. Partners of collisions are then located with
+   *  the same lookup in interior and boundary cells; a subdomain boundary only
+   *  needs its ghost cells to point to the received cells.
+   */
+  int n_halo_x, n_halo_y;                     /*!< Width of the ghost layer (cells)                   */
+  ev_matrix::MaskMatrix<int> halo_cell;       /*!< Owner of each (ghost) cell                         */
+  ev_matrix::MaskMatrix<int> halo_contact;    /*!< Owner of each (ghost) cell of the contact-point grid */
+  void setup_halo_map(void);
+
 public:
 
   // Init
@@ -66,10 +122,22 @@ public:
   void fill_dummy_field (void);
   void compute_reduced_density (void);
   void compute_avg_density (void);
+  void compute_correlation (void);
 
   // Density kernel in a packet
   void perform_density_kernel (void);
 
+  /*! \fn void DensityKernel::save_checkpoint(ev_checkpoint::CheckpointWriter&) const
+   *  \brief Writes the binning counter (all fields follow from the particles)
+   */
+  void save_checkpoint (ev_checkpoint::CheckpointWriter&) const;
+
+  /*! \fn void DensityKernel::load_checkpoint(ev_checkpoint::CheckpointReader&)
+   *  \brief Restores the counter and recomputes all fields, repeating the last binning
+   *  (particles were saved in its order, hence a sort would leave them in place)
+   */
+  void load_checkpoint (ev_checkpoint::CheckpointReader&);
+
   // GETTERS
   inline int get_n_cutoff_x(void) const { return n_cutoff_x; }
   inline int get_n_cutoff_y(void) const { return n_cutoff_y; }
@@ -89,6 +157,15 @@ public:
   inline const ev_matrix::MaskMatrix<int>& get_npc(void) const { return n_part_cell; }
   inline const ev_matrix::MaskMatrix<real_number>& get_aveta(void) const { return average_reduced_density; }
   inline const ev_matrix::SlideMaskMatrix<real_number>& get_weights(void) { return weights; }
+  inline int get_chi_ref(void) const { return chi_ref; }
+  inline real_number get_chi_contact(int i, int j) const { return chi_contact(i,j); }
+  inline const ev_matrix::MaskMatrix<real_number>& get_chi_contact(void) const { return chi_contact; }
+  inline const std::vector<int>& get_active_cells(void) const { return active_cells; }
+  inline real_number get_active_fraction(void) const { return active_cells.size() / (real_number)n_part_cell.size(); }
+  inline int get_n_halo_x(void) const { return n_halo_x; }
+  inline int get_n_halo_y(void) const { return n_halo_y; }
+  inline int get_halo_cell(int i, int j) const { return halo_cell(i,j); }
+  inline int get_halo_contact(int i, int j) const { return halo_contact(i,j); }
   inline const int iof(int k) const { return cum_num[k]; }
   inline const int ind(int k) const { return idx_map[k]; }
 
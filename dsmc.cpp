@@ -10,11 +10,26 @@
 #include "density.hpp"
 #include "force_field.hpp"
 #include "collisions.hpp"
+#include "wall_collisions.hpp"
 #include "advection.hpp"
 #include "thermostat.hpp"
 #include "sampling.hpp"
 #include "output.hpp"
 
+#include "snapshot.hpp"
+#include "checkpoint.hpp"
+
+#include <chrono>
+#include <csignal>
+
+// Last checkpoint request received (SIGUSR1 or SIGUSR2), polled once per iteration
+static volatile std::sig_atomic_t checkpoint_signal = 0;
+
+static void request_checkpoint(int signal)
+{
+  checkpoint_signal = signal;
+}
+
 DSMC::DSMC(const DefaultString& file_name):
 conf (
   new ConfigurationReader(this, file_name)
@@ -57,6 +72,9 @@ time_marching (
 collision_handler (
   new CollisionHandler(this)
 ),
+wall_collision_handler (
+  new WallCollisionHandler(this)
+),
 sampler (
   new Sampler(this)
 ),
@@ -69,6 +87,10 @@ n_iter_thermo ( conf->get_niter_thermo() ),
 n_iter_sample ( conf->get_niter_sampling() )
 {
 
+  // Checkpoint requests (the default action would terminate the run)
+  std::signal(SIGUSR1, request_checkpoint);
+  std::signal(SIGUSR2, request_checkpoint);
+
   /*!
    *  Establish whether the mean field has to be computed; mean field computation
    *  is very time consuming: better de-activate the routine if not needed
@@ -100,8 +122,23 @@ n_iter_sample ( conf->get_niter_sampling() )
   // test_output();
 
   std::cout << "### INITIALIZE DSMC SIMULATION ###" << std::endl;
-  initialize_simulation();
+  switch ( conf->get_restart() )
+  {
+    case CheckpointRestart:
+      t_restart = load_checkpoint();
+      break;
+    case MirrorRestart:
+      load_mirrored_checkpoint();
+      initialize_simulation();
+      break;
+    default:
+      initialize_simulation();
+  }
   test_output();
+  // test_wall_collisions(400);
+  // benchmark_collisions(10);
+  // benchmark_sampling(100);
+  // benchmark_sampling_scaling(20);
   display_barycentre();
   display_total_speed();
 
@@ -112,7 +149,9 @@ n_iter_sample ( conf->get_niter_sampling() )
 
   std::cout << "### TESTING DSMC ITERATIONS ###" << std::endl;
   int dummy_max_iter = DEFAULT_DUMMY_ITER;
-  for (int t = 0; t <= dummy_max_iter; ++t)
+  int t_next = t_restart, t_saved = t_restart;
+  std::chrono::steady_clock::time_point t_wall = std::chrono::steady_clock::now();
+  for (int t = t_restart; t <= dummy_max_iter; ++t)
   {
     std::cout << " >> iter = " << t << std::endl;
     dsmc_iteration();
@@ -121,18 +160,55 @@ n_iter_sample ( conf->get_niter_sampling() )
       std::cout << "    applying thermostat ..." << std::endl;
       thermostat->rescale_velocity();
     }
+    t_next = t+1;
     if (t%n_iter_sample==0)
     {
       std::cout << "    averaging ..." << std::endl;
       sampler->average();
       output_all_samples(t);
       sampler->reset();
+      // End of the transient (once, also when restarting): the windows so far are forgotten
+      if ( t >= DEFAULT_TRANSIENT_ITER && t-n_iter_sample < DEFAULT_TRANSIENT_ITER )
+      {
+        std::cout << "    end of transient: batch statistics restarted" << std::endl;
+        sampler->reset_statistics();
+      }
+      if ( sampler->get_n_batches() > 1 )
+        std::cout << "    relative error: numdens = " << sampler->relative_error(NumdensMoment)
+          << "; temp = " << sampler->relative_error(TempMoment) << std::endl;
+      if ( sampler->converged() )
+      {
+        std::cout << " >> samples converged after " << sampler->get_n_batches() << " windows" << std::endl;
+        break;
+      }
     }
     display_barycentre();
     display_total_speed();
+    // Checkpoints: every CHECKPOINT_PERIOD iterations, CHECKPOINT_WALLTIME seconds, or on request
+    int signal = checkpoint_signal;
+    bool timed = CHECKPOINT_WALLTIME > 0 && std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - t_wall ).count() >= CHECKPOINT_WALLTIME;
+    if ( ( CHECKPOINT_PERIOD > 0 && t_next%CHECKPOINT_PERIOD == 0 ) || timed || signal != 0 )
+    {
+      if ( signal != 0 )
+        std::cout << "    checkpoint requested (signal " << signal << ")" << std::endl;
+      checkpoint_signal = 0;
+      save_checkpoint(t_next);
+      t_saved = t_next;
+      t_wall = std::chrono::steady_clock::now();
+    }
+    if ( signal == SIGUSR2 )
+    {
+      std::cout << " >> stopping after iter = " << t << " (restart from checkpoint to continue)" << std::endl;
+      break;
+    }
   }
+  // The last checkpoint allows to extend the run
+  if ( t_saved != t_next )
+    save_checkpoint(t_next);
   output_collision_statistics();
   output_elapsed_times();
+  output->output_writer_statistics();
 
   std::cout << "### FINALIZING DSMC SIMULATION ###" << std::endl;
 
@@ -200,6 +276,7 @@ DSMC::test_density
   density->compute_reduced_density();
   std::cout << "### TEST: performing density convolution ###" << std::endl;
   density->compute_avg_density();
+  density->compute_correlation();
 }
 
 /*! \fn void DSMC::test_force_field (void)
@@ -270,6 +347,182 @@ DSMC::test_output
   output->output_collisions();
 }
 
+/*! \fn void DSMC::test_wall_collisions (int n_steps)
+    \brief Simulates n_steps gas-wall collision stages on a frozen gas at rest
+
+    Particles are not advected and their velocities are set to zero before each
+    stage, hence the relative velocity of a candidate is the one of the wall
+    particle: a particle at distance d < sigma_gw from a wall (at rest) collides at
+    rate n_w*chi_w*sigma_gw^2*<g>*(pi/2)*(1-d/sigma_gw), <g> being the mean speed of
+    wall particles. The time step is shortened so that particles collide about once
+    per stage at most; the number of particles that collided is compared with the
+    expected one, and the momentum gained by the gas has to be normal to the walls.
+    Velocities and time step are restored afterwards
+*/
+void
+DSMC::test_wall_collisions
+(int n_steps)
+{
+  std::cout << "### TEST: gas-wall collisions (frozen gas) ###" << std::endl;
+  if ( wall_collision_handler->get_n_band_cells() == 0 )
+  {
+    std::cout << " >> no solid walls" << std::endl;
+    return;
+  }
+  int np = ensemble->get_n_particles();
+  std::vector<real_number> vx(np), vy(np), vz(np);
+  for (int k = 0; k<np; ++k)
+  {
+    vx[k] = ensemble->get_vx(k);
+    vy[k] = ensemble->get_vy(k);
+    vz[k] = ensemble->get_vz(k);
+  }
+  // Edges: 0 = x1, 1 = y1, 2 = x2, 3 = y2 (see Boundary)
+  const std::array<char, 4>& wall_condition = boundary->get_wall_condition();
+  const real_number x_wall[4] = { -boundary->get_Lx1(), -boundary->get_Ly1(), boundary->get_Lx2(), boundary->get_Ly2() };
+  const real_number sigma_gw = species->get_diam_gw();
+  const real_number mass_fluid = species->get_mass_fluid();
+  const std::array<real_number, 4>& T_w = conf->get_T_w();
+  // Collision rate at contact with each wall
+  std::array<real_number, 4> rate_w;
+  real_number rate_max = 0.0;
+  for (int w = 0; w<4; ++w)
+  {
+    rate_w[w] = wall_collision_handler->get_n_wall() * wall_collision_handler->get_chi_wall() * sigma_gw*sigma_gw
+      * sqrt( 8.0*T_w[w] / ( ev_const::pi*species->get_mass_solid() ) ) * 0.5*ev_const::pi;
+    if ( wall_condition[w] == 'w' )
+      rate_max = std::max( rate_max, rate_w[w] );
+  }
+  const real_number delta_t = times->get_delta_t();
+  times->set_delta_t( 0.02 / rate_max );
+  // Wall facing particle k on the gas side (-1 if none) and its distance
+  auto facing_wall = [&] (int k, real_number& d)
+  {
+    real_number x = ensemble->get_xp(k), y = ensemble->get_yp(k);
+    const real_number dist[4] = { x-x_wall[0], y-x_wall[1], x_wall[2]-x, x_wall[3]-y };
+    for (int w = 0; w<4; ++w)
+      if ( wall_condition[w] == 'w' && dist[w] >= 0.0 && dist[w] < sigma_gw )
+      {
+        d = dist[w];
+        return w;
+      }
+    return -1;
+  };
+  // Expected number of particles colliding in a stage (Poisson: at least once)
+  real_number expected = 0.0, var_expected = 0.0, d;
+  for (int k = 0; k<np; ++k)
+  {
+    int w = facing_wall(k, d);
+    if ( w < 0 )
+      continue;
+    real_number p_coll = 1.0 - exp( -rate_w[w] * ( 1.0 - d/sigma_gw ) * times->get_delta_t() );
+    expected += p_coll;
+    var_expected += p_coll * ( 1.0 - p_coll );
+  }
+  // Momentum gained along the normal (towards the gas) and along the walls, with its variance
+  long n_collided = 0;
+  real_number p_normal = 0.0, p_tangent = 0.0, p_z = 0.0, var_tangent = 0.0, var_z = 0.0;
+  wall_collision_handler->compute_majorants();
+  for (int s = 0; s<n_steps; ++s)
+  {
+    for (int k = 0; k<np; ++k)
+    {
+      ensemble->get_vx(k) = 0.0;
+      ensemble->get_vy(k) = 0.0;
+      ensemble->get_vz(k) = 0.0;
+    }
+    wall_collision_handler->perform_collisions();
+    for (int k = 0; k<np; ++k)
+    {
+      int w = facing_wall(k, d);
+      if ( w < 0 )
+        continue;
+      real_number pn = mass_fluid * ( w%2 == 0 ? ensemble->get_vx(k) : ensemble->get_vy(k) );
+      real_number pt = mass_fluid * ( w%2 == 0 ? ensemble->get_vy(k) : ensemble->get_vx(k) );
+      real_number pz = mass_fluid * ensemble->get_vz(k);
+      if ( pn != 0.0 || pt != 0.0 || pz != 0.0 )
+        n_collided++;
+      p_normal += ( w < 2 ) ? pn : -pn;
+      p_tangent += pt;
+      p_z += pz;
+      var_tangent += pt*pt;
+      var_z += pz*pz;
+    }
+  }
+  real_number collided_stage = n_collided / (double)n_steps;
+  real_number tol_collided = 5.0 * sqrt( var_expected / n_steps );
+  real_number tol_tangent = 5.0 * sqrt( var_tangent ), tol_z = 5.0 * sqrt( var_z );
+  std::cout << " >> delta_t = " << times->get_delta_t() << ";\tparticles collided/stage = " << collided_stage
+    << ";\texpected = " << expected << " (tol " << tol_collided << ")" << std::endl;
+  std::cout << " >> momentum gained: normal = " << p_normal << ";\talong the wall = " << p_tangent
+    << " (tol " << tol_tangent << ");\tz = " << p_z << " (tol " << tol_z << ")" << std::endl;
+  if ( std::abs( collided_stage - expected ) > tol_collided )
+    std::cerr << "[!] GAS-WALL COLLISION FREQUENCY DOES NOT MATCH THE EXPECTED ONE" << std::endl;
+  if ( p_normal <= 0.0 || std::abs( p_tangent ) > tol_tangent || std::abs( p_z ) > tol_z )
+    std::cerr << "[!] GAS-WALL COLLISIONS TRANSFER TANGENTIAL MOMENTUM" << std::endl;
+  times->set_delta_t( delta_t );
+  for (int k = 0; k<np; ++k)
+  {
+    ensemble->get_vx(k) = vx[k];
+    ensemble->get_vy(k) = vy[k];
+    ensemble->get_vz(k) = vz[k];
+  }
+  wall_collision_handler->compute_majorants();
+}
+
+/*! \fn void DSMC::benchmark_collisions (int n_steps)
+    \brief Times all collision routines over the same particle configuration
+
+    For each routine majorants are re-estimated and n_steps collision stages are
+    performed; velocities (and the routine of choice) are restored afterwards.
+    Reports candidates and accepted collisions per second: the Poisson routine is
+    a reference, the accepted collisions per step must agree with the majorant one
+*/
+void
+DSMC::benchmark_collisions
+(int n_steps)
+{
+  std::cout << "### BENCHMARK: collision routines ###" << std::endl;
+  int np = ensemble->get_n_particles();
+  int routine_choice = collision_handler->get_routine_choice();
+  std::vector<real_number> vx(np), vy(np), vz(np);
+  for (int k = 0; k<np; ++k)
+  {
+    vx[k] = ensemble->get_vx(k);
+    vy[k] = ensemble->get_vy(k);
+    vz[k] = ensemble->get_vz(k);
+  }
+  const std::vector<int> schemes = { MajorantScheme, PoissonScheme };
+  std::vector<std::string> report;
+  for (auto it = schemes.cbegin(); it!=schemes.cend(); ++it)
+  {
+    collision_handler->set_routine(*it);
+    collision_handler->compute_majorants();
+    long n_cand = 0, n_real = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s<n_steps; ++s)
+    {
+      collision_handler->perform_collisions();
+      n_cand += collision_handler->get_n_total();
+      n_real += collision_handler->get_n_real();
+    }
+    double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    report.push_back( std::string(" >> routine = ") + collision_handler->get_routine_name()
+      + ";\tcand/s = " + std::to_string( n_cand/elapsed ) + ";\tacc/s = " + std::to_string( n_real/elapsed )
+      + ";\tacc/step = " + std::to_string( n_real/(double)n_steps ) );
+    for (int k = 0; k<np; ++k)
+    {
+      ensemble->get_vx(k) = vx[k];
+      ensemble->get_vy(k) = vy[k];
+      ensemble->get_vz(k) = vz[k];
+    }
+  }
+  for (auto it = report.cbegin(); it!=report.cend(); ++it)
+    std::cout << *it << std::endl;
+  collision_handler->set_routine(routine_choice);
+  collision_handler->compute_majorants();
+}
+
 /*! \fn void DSMC::display_barycentre (void) const
     \brief Displays the centre of mass of the system
 */
@@ -308,6 +561,191 @@ DSMC::initialize_simulation
   density->perform_density_kernel();
   std::cout << "### INITIALIZINING COLLISIONS MAJORANTS ###" << std::endl;
   collision_handler->compute_majorants();
+  wall_collision_handler->compute_majorants();
+}
+
+/*! \fn void DSMC::save_checkpoint (int t_next)
+    \brief Writes the state of all modules to CHECKPOINT_FILE, to be continued from iteration t_next
+
+    Particles, random streams, majorants and sampling accumulators are stored as they
+    are in memory, hence a restarted run continues bit for bit as the original one
+    (with the same executable and number of threads). The state is copied into a
+    staging buffer, written to disk in background (see CHECKPOINT_ASYNC)
+*/
+void
+DSMC::save_checkpoint
+(int t_next)
+{
+  std::cout << "    saving checkpoint ..." << std::endl;
+  ev_checkpoint::CheckpointWriter checkpoint( output->checkpoint_staging() );
+  checkpoint.section("dsmc");
+  checkpoint.put<int32_t>(t_next);
+  checkpoint.put<int32_t>(grid->get_n_cells_x());
+  checkpoint.put<int32_t>(grid->get_n_cells_y());
+  checkpoint.put<real_number>(grid->get_x_min());
+  checkpoint.put<real_number>(grid->get_x_max());
+  checkpoint.put<real_number>(grid->get_y_min());
+  checkpoint.put<real_number>(grid->get_y_max());
+  rng->save_state(checkpoint.stream());
+  ensemble->save_checkpoint(checkpoint);
+  density->save_checkpoint(checkpoint);
+  collision_handler->save_checkpoint(checkpoint);
+  wall_collision_handler->save_checkpoint(checkpoint);
+  sampler->save_checkpoint(checkpoint);
+  std::size_t n_bytes = checkpoint.get_size();
+  double stall = output->output_checkpoint(checkpoint.release(), CHECKPOINT_FILE);
+  std::cout << "    checkpoint: " << n_bytes/1.0e6 << " MB; simulation stalled " << 1.0e3*stall << " ms" << std::endl;
+}
+
+/*! \fn int DSMC::load_checkpoint (void)
+    \brief Restores the state of all modules from CHECKPOINT_FILE; returns the next iteration
+
+    Replaces initialize_simulation: density fields follow from the particles, while
+    majorants are the saved ones (no new estimate is drawn)
+*/
+int
+DSMC::load_checkpoint
+(void)
+{
+  std::cout << "### RESTARTING FROM " << CHECKPOINT_FILE << " ###" << std::endl;
+  ev_checkpoint::CheckpointReader checkpoint(CHECKPOINT_FILE);
+  checkpoint.expect_section("dsmc");
+  int t_next = checkpoint.get<int32_t>();
+  int nx = checkpoint.get<int32_t>(), ny = checkpoint.get<int32_t>();
+  real_number x_min = checkpoint.get<real_number>(), x_max = checkpoint.get<real_number>();
+  real_number y_min = checkpoint.get<real_number>(), y_max = checkpoint.get<real_number>();
+  if ( nx != grid->get_n_cells_x() || ny != grid->get_n_cells_y() || x_min != grid->get_x_min()
+    || x_max != grid->get_x_max() || y_min != grid->get_y_min() || y_max != grid->get_y_max() )
+    throw "DSMC: checkpoint saved on a different grid (use restart = 2 to mirror it)";
+  rng->load_state(checkpoint.stream());
+  ensemble->load_checkpoint(checkpoint);
+  density->load_checkpoint(checkpoint);
+  collision_handler->load_checkpoint(checkpoint);
+  wall_collision_handler->load_checkpoint(checkpoint);
+  sampler->load_checkpoint(checkpoint);
+  std::cout << " >> continuing from iter = " << t_next << std::endl;
+  return t_next;
+}
+
+/*! \fn void DSMC::load_mirrored_checkpoint (void)
+    \brief Doubles the particles of CHECKPOINT_FILE onto the current domain (see Ensemble::load_mirrored)
+
+    Only the particles are restored: the run starts from iteration 0, with fresh
+    majorants and samples, but without re-equilibrating the (mirrored) configuration
+*/
+void
+DSMC::load_mirrored_checkpoint
+(void)
+{
+  std::cout << "### MIRRORING " << CHECKPOINT_FILE << " ###" << std::endl;
+  ev_checkpoint::CheckpointReader checkpoint(CHECKPOINT_FILE);
+  checkpoint.expect_section("dsmc");
+  checkpoint.get<int32_t>();
+  checkpoint.get<int32_t>();
+  checkpoint.get<int32_t>();
+  real_number x_min = checkpoint.get<real_number>(), x_max = checkpoint.get<real_number>();
+  real_number y_min = checkpoint.get<real_number>(), y_max = checkpoint.get<real_number>();
+  // The saved stream is skipped: the current one (seeded by the configuration) is kept
+  RandomEngine saved_rng(1);
+  saved_rng.load_state(checkpoint.stream());
+  ensemble->load_mirrored(checkpoint, x_min, x_max, y_min, y_max);
+}
+
+/*! \fn void DSMC::benchmark_sampling (int n_samples)
+    \brief Times the cell-ordered and the scatter sampler over the same particle configuration
+
+    Each routine samples n_samples times and averages; the averaged fields of the
+    two routines are compared (they differ only by round-off). The sampler is reset
+    afterwards. Reports particles sampled per second
+*/
+void
+DSMC::benchmark_sampling
+(int n_samples)
+{
+  std::cout << "### BENCHMARK: sampling routines ###" << std::endl;
+  int np = ensemble->get_n_particles();
+  std::vector< Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> > fields(N_MOMENTS);
+  std::vector<double> elapsed(2);
+  for (int r = 0; r<2; ++r)
+  {
+    sampler->reset();
+    auto start = std::chrono::steady_clock::now();
+    for (int s = 0; s<n_samples; ++s)
+    {
+      if ( r == 0 )
+        sampler->sample_scatter();
+      else
+        sampler->sample_cells();
+    }
+    elapsed[r] = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+    sampler->average();
+    for (int m = 0; m<N_MOMENTS; ++m)
+    {
+      if ( r == 0 )
+        fields[m] = sampler->get_moment(m);
+      else
+        fields[m] = ( fields[m] - sampler->get_moment(m) ).abs();
+    }
+  }
+  real_number max_diff = 0.0;
+  for (auto it = fields.cbegin(); it!=fields.cend(); ++it)
+    max_diff = std::max( max_diff, it->maxCoeff() );
+  std::cout << " >> routine = scatter;\tpart/s = " << np*(double)n_samples/elapsed[0] << std::endl;
+  std::cout << " >> routine = cell-ordered;\tpart/s = " << np*(double)n_samples/elapsed[1]
+    << ";\tspeedup = " << elapsed[0]/elapsed[1] << std::endl;
+  std::cout << " >> max abs difference of averaged fields = " << max_diff << std::endl;
+  sampler->reset();
+}
+
+/*! \fn void DSMC::benchmark_sampling_scaling (int n_samples)
+    \brief Times both parallel sampling modes for 1, 2, 4, ... threads (up to the default number)
+
+    Averaged fields are compared with the ones obtained by one thread, which they
+    must match exactly. The number of threads and the sampler are reset afterwards
+*/
+void
+DSMC::benchmark_sampling_scaling
+(int n_samples)
+{
+  std::cout << "### BENCHMARK: sampling scaling ###" << std::endl;
+  int np = ensemble->get_n_particles();
+  int max_threads = ev_parallel::max_threads();
+  const std::vector<std::string> modes = { "cell-ordered", "tiled" };
+  for (std::size_t r = 0; r<modes.size(); ++r)
+  {
+    std::vector< Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> > fields(N_MOMENTS);
+    double elapsed_1 = 0.0;
+    for (int nt = 1; nt<=max_threads; nt *= 2)
+    {
+      ev_parallel::set_threads(nt);
+      sampler->reset();
+      auto start = std::chrono::steady_clock::now();
+      for (int s = 0; s<n_samples; ++s)
+      {
+        if ( r == 0 )
+          sampler->sample_cells();
+        else
+          sampler->sample_tiled();
+      }
+      double elapsed = std::chrono::duration<double>( std::chrono::steady_clock::now() - start ).count();
+      sampler->average();
+      real_number max_diff = 0.0;
+      for (int m = 0; m<N_MOMENTS; ++m)
+      {
+        if ( nt == 1 )
+          fields[m] = sampler->get_moment(m);
+        else
+          max_diff = std::max( max_diff, ( fields[m] - sampler->get_moment(m) ).abs().maxCoeff() );
+      }
+      if ( nt == 1 )
+        elapsed_1 = elapsed;
+      std::cout << " >> routine = " << modes[r] << ";\tthreads = " << nt
+        << ";\tpart/s = " << np*(double)n_samples/elapsed << ";\tspeedup = " << elapsed_1/elapsed
+        << ";\tdiff from 1 thread = " << max_diff << std::endl;
+    }
+  }
+  ev_parallel::set_threads(max_threads);
+  sampler->reset();
 }
 
 /*! \fn void DSMC::dsmc_iteration (void)
@@ -336,9 +774,11 @@ DSMC::dsmc_iteration
   density->perform_density_kernel();
   stopwatch.local_stop(DENSITY_TAG);
   stored_elapsed_times[DENSITY_TAG].push_back(stopwatch.get_local_elapsed(DENSITY_TAG));
+  std::cout << "    active cells = " << 100.0*density->get_active_fraction() << "%" << std::endl;
   std::cout << "    simulating collisions ..." << std::endl;
   stopwatch.local_start(COLLISION_TAG);
   collision_handler->perform_collision_kernel();
+  wall_collision_handler->perform_collision_kernel();
   stopwatch.local_stop(COLLISION_TAG);
   stored_elapsed_times[COLLISION_TAG].push_back(stopwatch.get_local_elapsed(COLLISION_TAG));
   std::cout << "    sampling ..." << std::endl;
@@ -383,6 +823,8 @@ DSMC::output_all_samples
   output->output_sample(sampler->get_aveta_avg(), "output_files/samples/test_sample_aveta.txt");
   output->output_sample(sampler->get_forces_x_avg(), "output_files/samples/test_sample_fx.txt");
   output->output_sample(sampler->get_forces_y_avg(), "output_files/samples/test_sample_fy.txt");
+  if ( sampler->histograms_enabled() )
+    output->output_sample(sampler->get_vdf(), "output_files/samples/test_sample_vdf.txt");
 }
 
 /*! \fn void DSMC::output_all_samples (real_number t)
@@ -393,6 +835,20 @@ DSMC::output_all_samples
 (real_number t)
 {
   std::cout << "### OUTPUT ALL SAMPLES ###" << std::endl;
+  if ( SNAPSHOT_OUTPUT )
+  {
+    output_snapshot(t);
+    return;
+  }
+  // Velocity distributions: bin centre, then (vx, vy, vz) of each region
+  if ( sampler->histograms_enabled() )
+    output->output_sample(sampler->get_vdf(), "output_files/samples/test_sample_vdf", t);
+  // Reduced fields replace the full grids (see Sampler::get_reduced_table for the columns)
+  if ( sampler->get_reduction() != NoReduction )
+  {
+    output->output_sample(sampler->get_reduced_table(), "output_files/samples/test_sample_reduced", t);
+    return;
+  }
   output->output_sample(sampler->get_vx_avg(), "output_files/samples/test_sample_vx", t);
   output->output_sample(sampler->get_vy_avg(), "output_files/samples/test_sample_vy", t);
   output->output_sample(sampler->get_vz_avg(), "output_files/samples/test_sample_vz", t);
@@ -410,10 +866,50 @@ DSMC::output_all_samples
   output->output_sample(sampler->get_aveta_avg(), "output_files/samples/test_sample_aveta", t);
   output->output_sample(sampler->get_forces_x_avg(), "output_files/samples/test_sample_fx", t);
   output->output_sample(sampler->get_forces_y_avg(), "output_files/samples/test_sample_fy", t);
+  // Errors of the window averages (from the spread of all windows so far)
+  for (int m = VxMoment; m<N_MOMENTS; ++m)
+    output->output_sample(sampler->get_error(m), "output_files/samples/test_error_" + std::string(moment_name(m)), t);
+}
+
+/*! \fn void DSMC::output_snapshot (real_number t)
+    \brief Outputs all samples of the step as a single binary file (see utility/snapshot.hpp),
+    or as a record of the time-series store
+*/
+void
+DSMC::output_snapshot
+(real_number t)
+{
+  ev_snapshot::Geometry geometry;
+  geometry.nx = grid->get_n_cells_x();
+  geometry.ny = grid->get_n_cells_y();
+  geometry.x_min = grid->get_x_min();
+  geometry.x_max = grid->get_x_max();
+  geometry.y_min = grid->get_y_min();
+  geometry.y_max = grid->get_y_max();
+  geometry.time = conf->get_t_ini() + t*conf->get_delta_t();
+  geometry.step = t;
+  ev_snapshot::SnapshotWriter snapshot(geometry);
+  if ( sampler->histograms_enabled() )
+    snapshot.add_field("vdf", sampler->get_vdf());
+  if ( sampler->get_reduction() != NoReduction )
+    snapshot.add_field("reduced", sampler->get_reduced_table());
+  else
+  {
+    for (int m = VxMoment; m<N_MOMENTS; ++m)
+      snapshot.add_field(moment_name(m), sampler->get_moment(m));
+    for (int m = VxMoment; m<N_MOMENTS; ++m)
+      snapshot.add_field("err_" + std::string(moment_name(m)), sampler->get_error(m));
+  }
+  if ( SNAPSHOT_OUTPUT == 2 )
+    // A restarted run opens a new store, not to overwrite the records of the previous one
+    output->append_snapshot(std::move(snapshot), t_restart == 0 ? "output_files/samples/series.evts"
+      : "output_files/samples/series_t=" + std::to_string(t_restart) + ".evts");
+  else
+    output->output_snapshot(std::move(snapshot), "output_files/samples/snapshot_t=" + std::to_string(t) + ".evs");
 }
 
 /*! \fn void DSMC::output_collision_statistics (void)
-    \brief Outputs collisions statistics (fake, real, total, out of bound)
+    \brief Outputs collisions statistics (fake, real, total, out of bound) and per-cell acceptance maps
 */
 void
 DSMC::output_collision_statistics
@@ -423,6 +919,7 @@ DSMC::output_collision_statistics
   output->output_vector(collision_handler->get_n_real_store(), "output_files/collisions_real.txt");
   output->output_vector(collision_handler->get_n_total_store(), "output_files/collisions_total.txt");
   output->output_vector(collision_handler->get_n_out_store(), "output_files/collisions_out.txt");
+  output->output_acceptance();
 }
 
 /*! \fn void DSMC::output_elapsed_times (void)
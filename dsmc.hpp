@@ -40,6 +40,56 @@
 #define DEFAULT_DUMMY_ITER 800
 #endif
 
+/*! \def DEFAULT_TRANSIENT_ITER
+    \brief Iterations of the initial transient: the batch statistics of the samples restart
+    after the first sampling window ending at or after this iteration
+*/
+#ifndef DEFAULT_TRANSIENT_ITER
+#define DEFAULT_TRANSIENT_ITER 0
+#endif
+
+/*! \def SNAPSHOT_OUTPUT
+    \brief If 1, all samples of a step go into a single binary snapshot (see utility/snapshot.hpp);
+    if 2, they are appended to a memory-mapped time-series store (see utility/timeseries.hpp);
+    if 0, each field is written as a text file
+*/
+#ifndef SNAPSHOT_OUTPUT
+#define SNAPSHOT_OUTPUT 1
+#endif
+
+/*! \def CHECKPOINT_PERIOD
+    \brief Iterations between two checkpoints (0 = only at the end of the run)
+*/
+#ifndef CHECKPOINT_PERIOD
+#define CHECKPOINT_PERIOD 100
+#endif
+
+/*! \def CHECKPOINT_WALLTIME
+    \brief Wall-clock seconds between two checkpoints (0 = off); a checkpoint is also written
+    on SIGUSR1, and on SIGUSR2 (e.g. sent by the batch scheduler before a time limit) the run
+    stops after writing it
+*/
+#ifndef CHECKPOINT_WALLTIME
+#define CHECKPOINT_WALLTIME 0
+#endif
+
+/*! \def CHECKPOINT_FILE
+    \brief Checkpoint written during the run, and read on restart
+*/
+#ifndef CHECKPOINT_FILE
+#define CHECKPOINT_FILE "output_files/checkpoint.evc"
+#endif
+
+/*! \enum RestartMode
+ *  \brief Initialization of a run ('restart' in the conf. file)
+ */
+enum RestartMode
+{
+  NoRestart = 0,          /*!< Ensemble populated from the configuration parameters           */
+  CheckpointRestart = 1,  /*!< Continue the run of CHECKPOINT_FILE exactly where it was saved  */
+  MirrorRestart = 2       /*!< Particles of CHECKPOINT_FILE, reflected onto a domain twice as wide */
+};
+
 /*!
  *  Stopwatch tags for partial times have been defined with meaningful names
  */
@@ -66,11 +116,18 @@ class Ensemble;
 class DensityKernel;
 class ForceField;
 class CollisionHandler;
+class WallCollisionHandler;
 class Sampler;
 class Output;
 
 template<MarchingType tm_type> class TimeMarching;
 
+namespace ev_checkpoint
+{
+  class CheckpointWriter;
+  class CheckpointReader;
+}
+
 /*! \class DSMC
  *  \brief Class for the overall DSMC procedure
  *
@@ -99,6 +156,7 @@ private:
   DefaultPointer<ForceField> mean_field;                  /*!< Forces kernel (storage and computation)  */
   DefaultPointer<TimeMarching<TM>> time_marching;         /*!< Advection scheme                         */
   DefaultPointer<CollisionHandler> collision_handler;     /*!< Collision simulator, majorants storage   */
+  DefaultPointer<WallCollisionHandler> wall_collision_handler;  /*!< Gas-wall collision simulator     */
   DefaultPointer<Sampler> sampler;                        /*!< Sampling of macroscopic quantities       */
   DefaultPointer<Output> output;                          /*!< Output functionalities                   */
   CorrelationFun correlation;                             /*!< Exp. the short-range correlation         */
@@ -108,6 +166,7 @@ private:
   int n_iter_thermo = DEFAULT_ITER_THERMO;                  /*!< Number of thermostat iterations (stored locally)   */
   int n_iter_sample = DEFAULT_ITER_SAMPLE;                  /*!< Number of sampling iterations (  "  "  )           */
   bool mean_field_gg;                                       /*!< Perform mean-field computation (yes = 1, no = 0)   */
+  int t_restart = 0;                                        /*!< First iteration (restart from checkpoint)          */
   std::map < int, std::vector<int> > stored_elapsed_times;  /*!< Cumulative elapsed times (see #define tags above)  */
 
 public:
@@ -129,6 +188,7 @@ public:
   inline DefaultPointer<ForceField>& get_mean_field() { return mean_field; }
   inline DefaultPointer<TimeMarching<TM>>& get_time_marching() { return time_marching; }
   inline DefaultPointer<CollisionHandler>& get_collision_handler() { return collision_handler; }
+  inline DefaultPointer<WallCollisionHandler>& get_wall_collision_handler() { return wall_collision_handler; }
   inline DefaultPointer<Sampler>& get_sampler() { return sampler; }
   inline DefaultPointer<Output>& get_output() { return output; }
   inline CorrelationFun& get_correlation() { return correlation; }
@@ -143,6 +203,10 @@ public:
   void test_collisions(void);
   void test_sampling(void);
   void test_output(void);
+  void test_wall_collisions(int);
+  void benchmark_collisions(int);
+  void benchmark_sampling(int);
+  void benchmark_sampling_scaling(int);
   void display_barycentre(void) const;
   void display_total_speed(void) const;
 
@@ -151,9 +215,15 @@ public:
   void dsmc_iteration(void);
   void dsmc_loop(void); /* UNUSED */
 
+  // CHECKPOINT AND RESTART
+  void save_checkpoint(int);
+  int load_checkpoint(void);
+  void load_mirrored_checkpoint(void);
+
   // OUTPUT FEATURES
   void output_all_samples(void);
   void output_all_samples(real_number);
+  void output_snapshot(real_number);
   void output_collision_statistics(void);
   void output_elapsed_times(void);
 
@@ -131,6 +131,7 @@ void
 ForceField::compute_force_field
 (void)
 {
+  // Full grid: the force is sampled in every cell, including momentarily empty ones
   force_x_convolutioner.convolute();
   // force_x_matrix *= (dx*dy);
   force_y_convolutioner.convolute();
@@ -27,6 +27,7 @@ protected:
   DefaultPointer<ForceField>& mean_field;
   DefaultPointer<TimeMarching<TM>>& time_marching;
   DefaultPointer<CollisionHandler>& collision_handler;
+  DefaultPointer<WallCollisionHandler>& wall_collision_handler;
   DefaultPointer<Sampler>& sampler;
   DefaultPointer<Output>& output;
 
@@ -52,6 +53,7 @@ public:
     mean_field        (dsmc->get_mean_field()),
     time_marching     (dsmc->get_time_marching()),
     collision_handler (dsmc->get_collision_handler()),
+    wall_collision_handler (dsmc->get_wall_collision_handler()),
     sampler           (dsmc->get_sampler()),
     output            (dsmc->get_output()),
 
@@ -104,6 +104,85 @@ Output::output_collisions
 
 }
 
+void
+Output::output_snapshot
+(ev_snapshot::SnapshotWriter&& snapshot, const DefaultString& file_name)
+{
+
+  // Returns as soon as a queue slot is free: formatting and writing overlap the next steps
+  snapshot_writer.push(std::move(snapshot), file_name);
+
+}
+
+void
+Output::append_snapshot
+(ev_snapshot::SnapshotWriter&& snapshot, const DefaultString& file_name)
+{
+
+  // All steps go into the same store (created at the first call, see utility/timeseries.hpp)
+  snapshot_writer.push(std::move(snapshot), file_name, true);
+
+}
+
+void
+Output::flush_snapshots
+(void)
+{
+
+  snapshot_writer.flush();
+
+}
+
+void
+Output::output_writer_statistics
+(void)
+{
+
+  snapshot_writer.flush();
+  std::cout << "### SNAPSHOT WRITER ###" << std::endl;
+  std::cout << " >> queue depth = " << snapshot_writer.get_depth() << "; max queued = "
+    << snapshot_writer.get_max_queued() << std::endl;
+  std::cout << " >> snapshots = " << snapshot_writer.get_n_written() << "/" << snapshot_writer.get_n_pushed()
+    << "; stalls (queue full) = " << snapshot_writer.get_n_stalls() << std::endl;
+  std::cout << " >> write time = " << snapshot_writer.get_write_time() << " s; simulation stalled = "
+    << snapshot_writer.get_stall_time() << " s" << std::endl;
+  const ev_snapshot::SnapshotCompressor& compressor = snapshot_writer.get_compressor();
+  if ( compressor.get_raw_bytes() > 0 )
+    std::cout << " >> compression (stages " << compressor.get_stages() << "): ratio = " << compressor.get_ratio()
+      << "; " << compressor.get_raw_bytes()/1.0e6 << " -> " << compressor.get_compressed_bytes()/1.0e6 << " MB; throughput = "
+      << compressor.get_raw_bytes()/1.0e6/compressor.get_seconds() << " MB/s" << std::endl;
+  checkpoint_writer.flush();
+  if ( checkpoint_writer.get_n_checkpoints() > 0 )
+  {
+    std::cout << "### CHECKPOINT WRITER ###" << std::endl;
+    std::cout << " >> checkpoints = " << checkpoint_writer.get_n_checkpoints() << "; size = "
+      << checkpoint_writer.get_last_bytes()/1.0e6 << " MB; " << ( checkpoint_writer.is_asynchronous() ? "background" : "synchronous" )
+      << " writes" << std::endl;
+    std::cout << " >> write time = " << checkpoint_writer.get_write_time() << " s; simulation stalled = "
+      << checkpoint_writer.get_stall_time() << " s (longest " << checkpoint_writer.get_max_stall() << " s)" << std::endl;
+  }
+
+}
+
+std::vector<char>
+Output::checkpoint_staging
+(void)
+{
+
+  // Waits for the previous checkpoint to be on disk: its buffer is reused
+  return checkpoint_writer.acquire();
+
+}
+
+double
+Output::output_checkpoint
+(std::vector<char>&& image, const DefaultString& file_name)
+{
+
+  return checkpoint_writer.submit(std::move(image), file_name);
+
+}
+
 void
 Output::output_collisions_stat
 (void)
@@ -121,6 +200,32 @@ Output::output_collisions_stat
 
 }
 
+void
+Output::output_acceptance
+(void)
+{
+
+  std::ofstream file1("output_files/acceptance.txt");
+  std::ofstream file2("output_files/overshoot.txt");
+  const ev_matrix::MaskMatrix<int>& cand = collision_handler->get_cand_cell_tot();
+  ev_matrix::MaskMatrix<real_number> ratio(cand.get_lx(), cand.get_ux(), cand.get_ly(), cand.get_uy(), 0.0);
+  ev_matrix::MaskMatrix<real_number> n_cand(cand.get_lx(), cand.get_ux(), cand.get_ly(), cand.get_uy(), 0.0);
+  n_cand.copy_cast(cand);
+  n_cand = n_cand.max(1.0);
+
+  // Output real/candidate ratio for each cell
+  ratio.copy_cast(collision_handler->get_real_cell_tot());
+  ratio = ratio / n_cand;
+  file1 << ratio;
+  file1.close();
+
+  // Output out-of-bound/candidate ratio for each cell
+  ratio.copy_cast(collision_handler->get_over_cell_tot());
+  ratio = ratio / n_cand;
+  file2 << ratio;
+  file2.close();
+
+}
 
 // DEBUG
 // # # # # #
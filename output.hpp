@@ -7,11 +7,16 @@
 
 #include "motherbase.hpp"
 #include "matrix.hpp"
+#include "async_writer.hpp"
+#include "checkpoint.hpp"
 
 class Output : protected Motherbase
 {
 private:
 
+  ev_snapshot::AsyncWriter snapshot_writer;   /*!< Background writer of binary snapshots */
+  ev_checkpoint::AsyncCheckpointWriter checkpoint_writer;   /*!< Background writer of checkpoints */
+
 public:
 
   Output(DSMC*);
@@ -25,9 +30,9 @@ public:
   void output_majorants(void);
   void output_collisions(void);
 
-  // Output sample
-  template <class data_type>
-  void output_sample(ev_matrix::MaskMatrix<data_type>& sample, const DefaultString& file_name)
+  // Output sample (any Eigen array or view, e.g. MaskMatrix or Sampler::MomentView)
+  template <class Derived>
+  void output_sample(const Eigen::DenseBase<Derived>& sample, const DefaultString& file_name)
   {
     std::ofstream file1(file_name);
     file1 << sample;
@@ -35,8 +40,8 @@ public:
   }
 
   // Output sample, with label
-  template <class data_type, class tag_type>
-  void output_sample(ev_matrix::MaskMatrix<data_type>& sample, const DefaultString& file_name, tag_type label)
+  template <class Derived, class tag_type>
+  void output_sample(const Eigen::DenseBase<Derived>& sample, const DefaultString& file_name, tag_type label)
   {
     DefaultString file_name_tag = file_name + "_t=" + std::to_string(label) + ".txt";
     std::ofstream file1(file_name_tag);
@@ -54,8 +59,19 @@ public:
     file1.close();
   }
 
+  // Output snapshot (ownership is handed to the background writer)
+  void output_snapshot(ev_snapshot::SnapshotWriter&&, const DefaultString&);
+  void append_snapshot(ev_snapshot::SnapshotWriter&&, const DefaultString&);
+  void flush_snapshots(void);
+  void output_writer_statistics(void);
+
+  // Output checkpoint (the image is filled in the staging buffer, then written in background)
+  std::vector<char> checkpoint_staging(void);
+  double output_checkpoint(std::vector<char>&&, const DefaultString&);
+
   // Output collisions statistics
   void output_collisions_stat(void);
+  void output_acceptance(void);
 
   // Output function form vectors
   void output_fun_vec(const std::vector<real_number>&,
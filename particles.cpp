@@ -3,6 +3,11 @@
 #include "boundary.hpp"
 #include "configuration.hpp"
 
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <cmath>
+
 Ensemble::Ensemble
 (DSMC* dsmc):
   Motherbase(dsmc),
@@ -120,15 +125,16 @@ Ensemble::populate
     /* # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # # */
   }
 
+  // Velocities are drawn in a batch, then scattered into particles
+  std::vector<real_number> vx_new(n_particles), vy_new(n_particles), vz_new(n_particles);
+  rng->fill_maxwellian( mass, T_ini, 0.0, 0.0, vx_new.data(), vy_new.data(), vz_new.data(), n_particles );
   for ( int i = 0; i<n_particles; ++i )
   {
     particles[i].cell_x = (int) ( (particles[i].xp - grid->get_x_min() ) / grid->get_dx() );
     particles[i].cell_y = (int) ( (particles[i].yp - grid->get_y_min() ) / grid->get_dy() );
-    rng->sample_box_muller (
-      mass, 0.0, 0.0, T_ini,
-      particles[i].vx,
-      particles[i].vy,
-      particles[i].vz );
+    particles[i].vx = vx_new[i];
+    particles[i].vy = vy_new[i];
+    particles[i].vz = vz_new[i];
     particles[i].vx += vx_ini;
     particles[i].vy += vy_ini;
     particles[i].vz += vz_ini;
@@ -178,6 +184,86 @@ Ensemble::compute_total_speed
 }
 
 
+void
+Ensemble::save_checkpoint
+(ev_checkpoint::CheckpointWriter& checkpoint) const
+{
+  checkpoint.section("ensemble");
+  checkpoint.put<int32_t>(sizeof(Particle));
+  checkpoint.put<int32_t>(n_particles);
+  checkpoint.put_vector(particles);
+}
+
+void
+Ensemble::read_particles
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  checkpoint.expect_section("ensemble");
+  if ( checkpoint.get<int32_t>() != (int32_t)sizeof(Particle) )
+    throw "Ensemble: checkpoint written with a different particle layout";
+  n_particles = checkpoint.get<int32_t>();
+  checkpoint.get_vector(particles);
+  if ( (int)particles.size() != n_particles )
+    throw "Ensemble: corrupted checkpoint";
+}
+
+void
+Ensemble::load_checkpoint
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  read_particles(checkpoint);
+  if ( n_particles != conf->get_n_part() )
+    std::cout << " >> restart: " << n_particles << " particles (configuration: " << conf->get_n_part() << ")" << std::endl;
+}
+
+void
+Ensemble::load_mirrored
+(ev_checkpoint::CheckpointReader& checkpoint, real_number x_min_old, real_number x_max_old,
+  real_number y_min_old, real_number y_max_old)
+{
+  read_particles(checkpoint);
+  const real_number lx_old = x_max_old - x_min_old, ly_old = y_max_old - y_min_old;
+  const real_number lx = grid->get_x_max() - grid->get_x_min(), ly = grid->get_y_max() - grid->get_y_min();
+  const real_number tol = 1e-9;
+  bool mirror_x = std::abs( lx - 2.0*lx_old ) < tol*lx && std::abs( ly - ly_old ) < tol*ly;
+  bool mirror_y = std::abs( ly - 2.0*ly_old ) < tol*ly && std::abs( lx - lx_old ) < tol*lx;
+  if ( !mirror_x && !mirror_y )
+    throw "Ensemble: mirrored restart needs a domain twice as wide along x or y";
+  std::cout << " >> restart: mirroring " << n_particles << " particles along " << ( mirror_x ? "x" : "y" ) << std::endl;
+  // Originals keep their offset from the lower corner, copies are reflected across x_min+lx_old (or y_min+ly_old)
+  const int n_old = n_particles;
+  n_particles = 2*n_old;
+  particles.resize(n_particles);
+  for ( int i = 0; i<n_old; ++i )
+  {
+    Particle& p = particles[i];
+    Particle& q = particles[n_old+i];
+    p.xp = grid->get_x_min() + ( p.xp - x_min_old );
+    p.yp = grid->get_y_min() + ( p.yp - y_min_old );
+    q = p;
+    if ( mirror_x )
+    {
+      q.xp = 2.0*( grid->get_x_min() + lx_old ) - p.xp;
+      q.vx = -p.vx;
+    }
+    else
+    {
+      q.yp = 2.0*( grid->get_y_min() + ly_old ) - p.yp;
+      q.vy = -p.vy;
+    }
+    q.p_tag = p.p_tag + n_old;
+  }
+  // A particle on the lower edge is reflected onto the upper one, i.e. outside the last cell
+  for ( int i = 0; i<n_particles; ++i )
+  {
+    particles[i].cell_x = std::min( (int) ( (particles[i].xp - grid->get_x_min() ) / grid->get_dx() ), grid->get_n_cells_x()-1 );
+    particles[i].cell_y = std::min( (int) ( (particles[i].yp - grid->get_y_min() ) / grid->get_dy() ), grid->get_n_cells_y()-1 );
+  }
+  if ( n_particles != conf->get_n_part() )
+    std::cout << " >> restart: " << n_particles << " particles (configuration: " << conf->get_n_part() << ")" << std::endl;
+}
+
+
 /*
 void
 Ensemble::test_stream
@@ -46,6 +46,11 @@ private:
    */
   void populate(void);
 
+  /*! \fn void read_particles(ev_checkpoint::CheckpointReader&)
+   *  \brief Reads the particles section of a checkpoint
+   */
+  void read_particles(ev_checkpoint::CheckpointReader&);
+
 public:
 
   Ensemble(DSMC*);
@@ -63,6 +68,22 @@ public:
   void compute_baricentre(void);
   void compute_total_speed(void);
 
+  /* CHECKPOINT */
+  /*! \fn void save_checkpoint(ev_checkpoint::CheckpointWriter&) const
+   *  \brief Writes all particles to the checkpoint
+   */
+  void save_checkpoint(ev_checkpoint::CheckpointWriter&) const;
+  /*! \fn void load_checkpoint(ev_checkpoint::CheckpointReader&)
+   *  \brief Replaces the ensemble with the particles of the checkpoint
+   */
+  void load_checkpoint(ev_checkpoint::CheckpointReader&);
+  /*! \fn void load_mirrored(ev_checkpoint::CheckpointReader&, real_number, real_number, real_number, real_number)
+   *  \brief Replaces the ensemble with the particles of a checkpoint saved on the domain
+   *  [x_min,x_max]x[y_min,y_max], and with their reflection across the far edge of the
+   *  saved domain (the current one has to be twice as wide along x or y)
+   */
+  void load_mirrored(ev_checkpoint::CheckpointReader&, real_number, real_number, real_number, real_number);
+
   // Parameter getters
   inline const int& get_n_particles(void) const { return n_particles; }
 
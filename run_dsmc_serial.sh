@@ -3,6 +3,7 @@
 #$ -V
 #$ -pe mpi 4
 #$ -cwd
+#$ -notify
 
 ####################################################################
 # INFO:
@@ -12,6 +13,10 @@
 # 3/ Submit the job, the calculations will be performed on the scratch
 #    and the result will be copied back in the command folder
 # 4/ Set the number of cpus you need by defining the entry -pe mpi NCPU
+# 5/ With -notify the scheduler sends SIGUSR2 before killing the job (e.g.
+#    at the time limit): the run writes output_files/checkpoint.evc and stops;
+#    resubmit with 'Restart' = 1 in the conf. file to continue. SIGUSR1 (sent
+#    before a suspension, or by kill -USR1) writes a checkpoint, the run goes on
 ####################################################################
 
 ####################################################################
@@ -29,6 +34,17 @@ mkdir output_files/samples
 
 # time /home/matematica/barbante/non_ideal_fluid/Programmi/ev_pist_3b.exe &> out
 # mpirun -np 4 /home/matematica/barbante/non_ideal_fluid/Programmi/ev_pist_3b.exe &> out
-time /home/matematica/mpellegrino/enskog_vlasov/enskog_vlasov_serial/main &> main.log
+
+# The notify signals would terminate this (non-interactive) shell: main runs in
+# the background and the signals are forwarded to it (main installs its own handlers)
+/home/matematica/mpellegrino/enskog_vlasov/enskog_vlasov_serial/main &> main.log &
+pid=$!
+trap 'kill -USR1 $pid' USR1
+trap 'kill -USR2 $pid' USR2
+# wait returns early when a trapped signal arrives: wait again until main exits
+while kill -0 $pid 2> /dev/null; do
+  wait $pid
+done
+echo "elapsed time: $SECONDS s" >> main.log
 
 #####################################################################
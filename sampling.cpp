@@ -7,166 +7,560 @@
 #include "particles.hpp"
 #include "density.hpp"
 #include "force_field.hpp"
+#include "configuration.hpp"
+
+#include "checkpoint.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <cmath>
 
 Sampler::Sampler(DSMC* dsmc):
 
   Motherbase(dsmc),
 
-  inner_counter       ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
-  inner_counter_cast  ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  dt_factor           ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-
-  vx_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  vy_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  vz_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  temp_avg    ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pxx_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pyy_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pzz_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pxy_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pxz_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  pyz_avg     ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  qx_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  qy_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  qz_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-
-  numdens_avg ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  aveta_avg   ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  fx_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
-  fy_avg      ( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 )
-
-  { }
+  nx( grid->get_n_cells_x() ),
+  ny( grid->get_n_cells_y() ),
+
+  moments( grid->get_n_cells()*N_MOMENTS, 0.0 ),
+
+  n_bins( std::max( conf->get_Nv(), 0 ) ),
+  n_regions( std::max( conf->get_ndom(), 0 ) ),
+  v_hist( HISTOGRAM_N_SIGMA * sqrt( conf->get_T_ini() / species->get_mass_fluid() ) ),
+  rdv_hist( n_bins / ( 2.0*v_hist ) ),
+  cell_region( grid->get_n_cells(), -1 ),
+  vel_hist( 3*n_bins*n_regions, 0 ),
+  out_of_range( n_regions, 0 ),
+  vdf( std::max(n_bins, 1), 1+3*n_regions ),
+
+  reduction( SAMPLE_REDUCTION ),
+  reduce_map( grid->get_n_cells(), -1 ),
+
+  window_length( conf->get_niter_sampling() ),
+  batch_mean( grid->get_n_cells()*N_MOMENTS, 0.0 ),
+  batch_m2( grid->get_n_cells()*N_MOMENTS, 0.0 ),
+  batch_err( grid->get_n_cells()*N_MOMENTS, 0.0 )
+
+  {
+    // Default regions: ndom slabs of cell rows along y
+    for (int j = 0; j<ny; ++j)
+      for (int i = 0; i<nx; ++i)
+        cell_region[i+j*nx] = n_regions > 0 ? (int)( (long)j*n_regions/ny ) : -1;
+    vdf.fill(0.0);
+    for (int b = 0; b<n_bins; ++b)
+      vdf(b, 0) = -v_hist + ( b + 0.5 ) / rdv_hist;
+    if ( histograms_enabled() )
+      std::cout << " >> velocity histograms: " << n_regions << " regions x " << n_bins
+        << " bins in [" << -v_hist << ", " << v_hist << ")" << std::endl;
+    if ( reduction == AutoReduction )
+    {
+      switch( conf->get_liq_interf() )
+      {
+        case 5:   /* Liquid layer parallel to the x axis */
+          reduction = ProfileAlongY;
+          break;
+        case 6:   /* Liquid layer parallel to the y axis */
+          reduction = ProfileAlongX;
+          break;
+        default:
+          reduction = NoReduction;
+      }
+    }
+    setup_reduction();
+  }
+
+void
+Sampler::setup_reduction
+(void)
+{
+  switch( reduction )
+  {
+    case ProfileAlongX:
+      n_reduced = nx;
+      break;
+    case ProfileAlongY:
+      n_reduced = ny;
+      break;
+    case SubdomainAverage:
+      n_reduced = n_regions;
+      break;
+    case NoReduction:
+      n_reduced = 0;
+      break;
+    default:
+      throw "Sampler: unknown reduction";
+  }
+  reduce_cells.assign(n_reduced, 0);
+  reduce_coord.assign(n_reduced, 0.0);
+  for (int j = 0; j<ny; ++j)
+  {
+    for (int i = 0; i<nx; ++i)
+    {
+      int c = i + j*nx;
+      reduce_map[c] = reduction == ProfileAlongX ? i : reduction == ProfileAlongY ? j
+        : reduction == SubdomainAverage ? cell_region[c] : -1;
+      if ( reduce_map[c] >= 0 )
+      {
+        reduce_cells[reduce_map[c]]++;
+        reduce_coord[reduce_map[c]] = reduction == ProfileAlongX ? grid->get_xc(i)
+          : reduction == ProfileAlongY ? grid->get_yc(j) : reduce_map[c];
+      }
+    }
+  }
+  for (int r = 0; r<n_reduced; ++r)
+    if ( reduce_cells[r] == 0 )
+      throw "Sampler: empty subdomain";
+  reduced.assign(n_reduced*N_MOMENTS, 0.0);
+  reduced_mean.assign(n_reduced*N_MOMENTS, 0.0);
+  reduced_m2.assign(n_reduced*N_MOMENTS, 0.0);
+  reduced_err.assign(n_reduced*N_MOMENTS, 0.0);
+  if ( n_reduced > 0 )
+    std::cout << " >> sampled fields reduced to " << n_reduced << " records" << std::endl;
+}
+
+void
+Sampler::set_cell_region
+(const std::vector<int>& region)
+{
+  if ( region.size() != cell_region.size() )
+    throw "Sampler: cell-region map does not match the grid";
+  for (auto it = region.cbegin(); it!=region.cend(); ++it)
+    if ( *it >= n_regions )
+      throw "Sampler: region index beyond ndom";
+  cell_region = region;
+  if ( reduction == SubdomainAverage )
+    setup_reduction();
+}
+
+void
+Sampler::merge_histograms
+(const std::vector<long>& hist, const std::vector<long>& out)
+{
+  for (std::size_t k = 0; k<hist.size(); ++k)
+    vel_hist[k] += hist[k];
+  for (std::size_t r = 0; r<out.size(); ++r)
+    out_of_range[r] += out[r];
+}
 
 void
 Sampler::reset
 (void)
 {
-  inner_counter = 0;
-  inner_counter_cast = 0.0;
-  dt_factor = 0.0;
-  vx_avg = 0.0;
-  vy_avg = 0.0;
-  vz_avg = 0.0;
-  temp_avg = 0.0;
-  pxx_avg = 0.0;
-  pyy_avg = 0.0;
-  pzz_avg = 0.0;
-  pxy_avg = 0.0;
-  pxz_avg = 0.0;
-  pyz_avg = 0.0;
-  qx_avg = 0.0;
-  qy_avg = 0.0;
-  qz_avg = 0.0;
-  numdens_avg = 0.0;
-  aveta_avg = 0.0;
-  fx_avg = 0.0;
-  fy_avg = 0.0;
-}
-
-/*
+  std::fill(moments.begin(), moments.end(), 0.0);
+  std::fill(vel_hist.begin(), vel_hist.end(), 0);
+  std::fill(out_of_range.begin(), out_of_range.end(), 0);
+}
+
+/*! \fn void Sampler::reset_statistics (void)
+    \brief Forgets all previous windows (e.g. at the end of a transient)
+*/
+void
+Sampler::reset_statistics
+(void)
+{
+  n_batches = 0;
+  std::fill(batch_mean.begin(), batch_mean.end(), 0.0);
+  std::fill(batch_m2.begin(), batch_m2.end(), 0.0);
+  std::fill(batch_err.begin(), batch_err.end(), 0.0);
+  std::fill(reduced_mean.begin(), reduced_mean.end(), 0.0);
+  std::fill(reduced_m2.begin(), reduced_m2.end(), 0.0);
+  std::fill(reduced_err.begin(), reduced_err.end(), 0.0);
+}
+
+void
+Sampler::save_checkpoint
+(ev_checkpoint::CheckpointWriter& checkpoint) const
+{
+  checkpoint.section("sampler");
+  checkpoint.put<int32_t>(outer_counter);
+  checkpoint.put_vector(moments);
+  checkpoint.put_vector(vel_hist);
+  checkpoint.put_vector(out_of_range);
+  checkpoint.put<int32_t>(n_batches);
+  checkpoint.put_vector(batch_mean);
+  checkpoint.put_vector(batch_m2);
+  checkpoint.put_vector(batch_err);
+  checkpoint.put_vector(reduced);
+  checkpoint.put_vector(reduced_mean);
+  checkpoint.put_vector(reduced_m2);
+  checkpoint.put_vector(reduced_err);
+}
+
+void
+Sampler::load_checkpoint
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  checkpoint.expect_section("sampler");
+  std::vector<std::size_t> sizes = { moments.size(), vel_hist.size(), reduced.size() };
+  checkpoint.get(outer_counter);
+  checkpoint.get_vector(moments);
+  checkpoint.get_vector(vel_hist);
+  checkpoint.get_vector(out_of_range);
+  checkpoint.get(n_batches);
+  checkpoint.get_vector(batch_mean);
+  checkpoint.get_vector(batch_m2);
+  checkpoint.get_vector(batch_err);
+  checkpoint.get_vector(reduced);
+  checkpoint.get_vector(reduced_mean);
+  checkpoint.get_vector(reduced_m2);
+  checkpoint.get_vector(reduced_err);
+  if ( sizes[0] != moments.size() || sizes[1] != vel_hist.size() || sizes[2] != reduced.size() )
+    throw "Sampler: checkpoint does not match the sampling parameters";
+}
+
+Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic>
+Sampler::get_reduced_table
+(void) const
+{
+  Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> table( n_reduced, 1+2*N_MOMENTS );
+  for (int r = 0; r<n_reduced; ++r)
+  {
+    table(r, 0) = reduce_coord[r];
+    for (int m = 0; m<N_MOMENTS; ++m)
+    {
+      table(r, 1+m) = reduced[r*N_MOMENTS+m];
+      table(r, 1+N_MOMENTS+m) = reduced_err[r*N_MOMENTS+m];
+    }
+  }
+  return table;
+}
+
+/*! \fn void Sampler::sample (void)
+    \brief Accumulates the current state according to TILED_SAMPLING
+*/
 void
 Sampler::sample
 (void)
 {
-  int nc = grid->get_n_cells();
-  int i, j, idx_p;
-  real_number vx, vy, vz, e_kin;
+#if TILED_SAMPLING
+  sample_tiled();
+#else
+  sample_cells();
+#endif
+}
+
+/*! \fn void Sampler::sample_cells (void)
+    \brief Accumulates moments cell by cell, over the contiguous particle ranges of the density map
+
+    Moments of a cell are summed in local variables and each record is written
+    once per active cell, instead of once per particle (see sample_scatter);
+    cells are shared among threads, each record being summed by one thread
+*/
+void
+Sampler::sample_cells
+(void)
+{
+  const std::vector<int>& active_cells = density->get_active_cells();
+  const int n_active = active_cells.size();
+  const bool binning = histograms_enabled();
   outer_counter++;
-  for ( int idx_c = 0; idx_c<nc; ++idx_c )
+  #pragma omp parallel
   {
-    i = grid->lexico_inv(idx_c).first;
-    j = grid->lexico_inv(idx_c).second;
-    for ( int k = density->iof(idx_c); k < density->iof(idx_c+1); ++k )
+    std::vector<long> hist( vel_hist.size(), 0 ), out( out_of_range.size(), 0 );
+    #pragma omp for schedule(dynamic, 64)
+    for (int a = 0; a<n_active; ++a)
     {
-      idx_p = density->ind(k);
-      vx = ensemble->get_vx(idx_p);
-      vy = ensemble->get_vy(idx_p);
-      vz = ensemble->get_vz(idx_p);
-      inner_counter(i,j)++;
-      vx_avg(i,j) += vx;
-      vy_avg(i,j) += vy;
-      vz_avg(i,j) += vz;
-      pxx_avg(i,j) += vx*vx;
-      pyy_avg(i,j) += vy*vy;
-      pzz_avg(i,j) += vz*vz;
-      pxy_avg(i,j) += vx*vy;
-      pxz_avg(i,j) += vx*vz;
-      pyz_avg(i,j) += vy*vz;
-      e_kin = vx*vx + vy*vy + vz*vz;
-      temp_avg(i,j) += e_kin;
-      qz_avg(i,j) += vz*e_kin;
-      qx_avg(i,j) += vx*e_kin;
-      qy_avg(i,j) += vy*e_kin;
+      const int cell = active_cells[a];
+      const int region = binning ? cell_region[cell] : -1;
+      int idx_p;
+      real_number vx, vy, vz, e_kin;
+      real_number svx, svy, svz, sxx, syy, szz, sxy, sxz, syz, se, sqx, sqy, sqz;
+      svx = svy = svz = sxx = syy = szz = sxy = sxz = syz = se = sqx = sqy = sqz = 0.0;
+      for ( int k = density->iof(cell); k < density->iof(cell+1); ++k )
+      {
+        idx_p = density->ind(k);
+        vx = ensemble->get_vx(idx_p);
+        vy = ensemble->get_vy(idx_p);
+        vz = ensemble->get_vz(idx_p);
+        svx += vx;
+        svy += vy;
+        svz += vz;
+        sxx += vx*vx;
+        syy += vy*vy;
+        szz += vz*vz;
+        sxy += vx*vy;
+        sxz += vx*vz;
+        syz += vy*vz;
+        e_kin = vx*vx + vy*vy + vz*vz;
+        se += e_kin;
+        sqx += vx*e_kin;
+        sqy += vy*e_kin;
+        sqz += vz*e_kin;
+        if ( region >= 0 )
+          bin_velocity(hist.data(), out.data(), region, vx, vy, vz);
+      }
+      real_number* rec = record(cell);
+      rec[CountMoment] += density->iof(cell+1) - density->iof(cell);
+      rec[VxMoment] += svx;
+      rec[VyMoment] += svy;
+      rec[VzMoment] += svz;
+      rec[TempMoment] += se;
+      rec[PxxMoment] += sxx;
+      rec[PyyMoment] += syy;
+      rec[PzzMoment] += szz;
+      rec[PxyMoment] += sxy;
+      rec[PxzMoment] += sxz;
+      rec[PyzMoment] += syz;
+      rec[QxMoment] += sqx;
+      rec[QyMoment] += sqy;
+      rec[QzMoment] += sqz;
+    }
+    if ( binning )
+    {
+      #pragma omp critical
+      merge_histograms(hist, out);
     }
   }
+  sample_fields();
 }
+
+/*! \fn void Sampler::sample_tiled (void)
+    \brief Accumulates moments in storage order into private tiles, merged by a fixed-order tree
+
+    Particles are split in SAMPLE_TILES blocks independently of the number of
+    threads, and tiles are summed pairwise (t += t+1, t += t+2, ...), hence each
+    value is obtained with the same sequence of operations for any thread count
 */
+void
+Sampler::sample_tiled
+(void)
+{
+  const int np = ensemble->get_n_particles();
+  const int nc = nx*ny;
+  const int tile_size = nc*N_PARTICLE_MOMENTS;
+  const bool binning = histograms_enabled();
+  tiles.resize( (std::size_t)SAMPLE_TILES*tile_size );
+  outer_counter++;
+  #pragma omp parallel
+  {
+    std::vector<long> hist( vel_hist.size(), 0 ), out( out_of_range.size(), 0 );
+    // Particles of each block into its tile
+    #pragma omp for schedule(dynamic, 1)
+    for (int b = 0; b<SAMPLE_TILES; ++b)
+    {
+      real_number* tile = tiles.data() + (std::size_t)b*tile_size;
+      std::fill(tile, tile+tile_size, 0.0);
+      real_number vx, vy, vz, e_kin;
+      real_number* rec;
+      int cell;
+      for ( int idx_p = (long)np*b/SAMPLE_TILES; idx_p<(long)np*(b+1)/SAMPLE_TILES; ++idx_p )
+      {
+        cell = ensemble->get_cx(idx_p) + ensemble->get_cy(idx_p)*nx;
+        rec = tile + cell*N_PARTICLE_MOMENTS;
+        vx = ensemble->get_vx(idx_p);
+        vy = ensemble->get_vy(idx_p);
+        vz = ensemble->get_vz(idx_p);
+        rec[CountMoment] += 1.0;
+        rec[VxMoment] += vx;
+        rec[VyMoment] += vy;
+        rec[VzMoment] += vz;
+        rec[PxxMoment] += vx*vx;
+        rec[PyyMoment] += vy*vy;
+        rec[PzzMoment] += vz*vz;
+        rec[PxyMoment] += vx*vy;
+        rec[PxzMoment] += vx*vz;
+        rec[PyzMoment] += vy*vz;
+        e_kin = vx*vx + vy*vy + vz*vz;
+        rec[TempMoment] += e_kin;
+        rec[QxMoment] += vx*e_kin;
+        rec[QyMoment] += vy*e_kin;
+        rec[QzMoment] += vz*e_kin;
+        if ( binning && cell_region[cell] >= 0 )
+          bin_velocity(hist.data(), out.data(), cell_region[cell], vx, vy, vz);
+      }
+    }
+    if ( binning )
+    {
+      #pragma omp critical
+      merge_histograms(hist, out);
+    }
+    // Pairwise tree over tiles (fixed order), the root is added to the records
+    #pragma omp for schedule(static)
+    for (int c = 0; c<nc; ++c)
+    {
+      real_number* rec = record(c);
+      real_number* tile_rec = tiles.data() + c*N_PARTICLE_MOMENTS;
+      for (int stride = 1; stride<SAMPLE_TILES; stride *= 2)
+        for (int b = 0; b+stride<SAMPLE_TILES; b += 2*stride)
+          for (int m = 0; m<N_PARTICLE_MOMENTS; ++m)
+            tile_rec[(std::size_t)b*tile_size+m] += tile_rec[(std::size_t)(b+stride)*tile_size+m];
+      for (int m = 0; m<N_PARTICLE_MOMENTS; ++m)
+        rec[m] += tile_rec[m];
+    }
+  }
+  sample_fields();
+}
 
+/*! \fn void Sampler::sample_scatter (void)
+    \brief Accumulates moments particle by particle, in storage order (reference for benchmarks)
+*/
 void
-Sampler::sample
+Sampler::sample_scatter
 (void)
 {
   int np = ensemble->get_n_particles();
-  int i, j;
   real_number vx, vy, vz, e_kin;
+  real_number* rec;
+  int cell;
+  const bool binning = histograms_enabled();
   outer_counter++;
   for ( int idx_p = 0; idx_p<np; ++idx_p )
   {
-    i = ensemble->get_cx(idx_p);
-    j = ensemble->get_cy(idx_p);
+    cell = ensemble->get_cx(idx_p) + ensemble->get_cy(idx_p)*nx;
+    rec = record(cell);
     vx = ensemble->get_vx(idx_p);
     vy = ensemble->get_vy(idx_p);
     vz = ensemble->get_vz(idx_p);
-    inner_counter(i,j)++;
-    vx_avg(i,j) += vx;
-    vy_avg(i,j) += vy;
-    vz_avg(i,j) += vz;
-    pxx_avg(i,j) += vx*vx;
-    pyy_avg(i,j) += vy*vy;
-    pzz_avg(i,j) += vz*vz;
-    pxy_avg(i,j) += vx*vy;
-    pxz_avg(i,j) += vx*vz;
-    pyz_avg(i,j) += vy*vz;
+    rec[CountMoment] += 1.0;
+    rec[VxMoment] += vx;
+    rec[VyMoment] += vy;
+    rec[VzMoment] += vz;
+    rec[PxxMoment] += vx*vx;
+    rec[PyyMoment] += vy*vy;
+    rec[PzzMoment] += vz*vz;
+    rec[PxyMoment] += vx*vy;
+    rec[PxzMoment] += vx*vz;
+    rec[PyzMoment] += vy*vz;
     e_kin = vx*vx + vy*vy + vz*vz;
-    temp_avg(i,j) += e_kin;
-    qz_avg(i,j) += vz*e_kin;
-    qx_avg(i,j) += vx*e_kin;
-    qy_avg(i,j) += vy*e_kin;
+    rec[TempMoment] += e_kin;
+    rec[QzMoment] += vz*e_kin;
+    rec[QxMoment] += vx*e_kin;
+    rec[QyMoment] += vy*e_kin;
+    if ( binning && cell_region[cell] >= 0 )
+      bin_velocity(vel_hist.data(), out_of_range.data(), cell_region[cell], vx, vy, vz);
   }
-  fx_avg += mean_field->get_force_x();
-  fy_avg += mean_field->get_force_y();
-  aveta_avg += density->get_aveta();
+  sample_fields();
 }
 
+void
+Sampler::sample_fields
+(void)
+{
+  #pragma omp parallel for schedule(static)
+  for (int j = 0; j<ny; ++j)
+  {
+    real_number* rec = record(j*nx);
+    for (int i = 0; i<nx; ++i, rec += N_MOMENTS)
+    {
+      rec[AvetaMoment] += density->get_aveta(i,j);
+      rec[FxMoment] += mean_field->get_force_x(i,j);
+      rec[FyMoment] += mean_field->get_force_y(i,j);
+    }
+  }
+}
+
+/*! \fn void Sampler::average (void)
+    \brief Turns the accumulated sums into averages, in a single pass over the cell records
+
+    The window averages of the record then update the batch statistics of the cell;
+    windows shorter or longer than the sampling period (e.g. the single sample at
+    t = 0) are averaged but left out of the statistics, whose batches must be equal
+*/
 void
 Sampler::average
 (void)
 {
 
-  inner_counter_cast.copy_cast<int>(inner_counter);
-  dt_factor = inner_counter_cast / ( (double)(outer_counter)*grid->get_cell_volume() );
-
-  vx_avg /= inner_counter_cast;
-  vy_avg /= inner_counter_cast;
-  vz_avg /= inner_counter_cast;
-  pxx_avg /= inner_counter_cast;    pxx_avg -= vx_avg*vx_avg;   pxx_avg *= dt_factor;
-  pyy_avg /= inner_counter_cast;    pyy_avg -= vy_avg*vy_avg;   pyy_avg *= dt_factor;
-  pzz_avg /= inner_counter_cast;    pzz_avg -= vz_avg*vz_avg;   pzz_avg *= dt_factor;
-  pxy_avg /= inner_counter_cast;    pxy_avg -= vx_avg*vy_avg;   pxy_avg *= dt_factor;
-  pxz_avg /= inner_counter_cast;    pxz_avg -= vx_avg*vz_avg;   pxz_avg *= dt_factor;
-  pyz_avg /= inner_counter_cast;    pyz_avg -= vy_avg*vz_avg;   pyz_avg *= dt_factor;
-  qz_avg /= 2.0*inner_counter_cast; qz_avg *= dt_factor;
-  qx_avg /= 2.0*inner_counter_cast; qx_avg *= dt_factor;
-  qy_avg /= 2.0*inner_counter_cast; qy_avg *= dt_factor;
-  temp_avg /= inner_counter_cast;
-  temp_avg = ( temp_avg -
-    vx_avg*vx_avg - vy_avg*vy_avg - vz_avg*vz_avg ) / 3.0;
-
-  fx_avg /= (double)outer_counter;
-  fx_avg /= (double)outer_counter;
-  aveta_avg /= (double)outer_counter;
-  numdens_avg = inner_counter_cast / ( (double)outer_counter * grid->get_cell_volume() );
+  const real_number ro = 1.0 / (double)outer_counter;
+  const real_number rv = ro / grid->get_cell_volume();
+  const bool in_batches = ( outer_counter == window_length );
+  if ( in_batches )
+    n_batches++;
+  else
+    std::cout << "    window of " << outer_counter << " samples left out of the batch statistics" << std::endl;
+  const real_number rb = in_batches ? 1.0 / (double)n_batches : 0.0;
+  const real_number rb1 = n_batches > 1 ? 1.0 / (double)(n_batches-1) : 0.0;
+
+  // Reduced records collect the sums of their cells, before these are averaged
+  if ( n_reduced > 0 )
+  {
+    std::fill(reduced.begin(), reduced.end(), 0.0);
+    for (int c = 0; c<nx*ny; ++c)
+    {
+      if ( reduce_map[c] < 0 )
+        continue;
+      const real_number* rec = record(c);
+      real_number* red = reduced.data() + reduce_map[c]*N_MOMENTS;
+      for (int m = 0; m<N_MOMENTS; ++m)
+        red[m] += rec[m];
+    }
+    for (int r = 0; r<n_reduced; ++r)
+    {
+      real_number* red = reduced.data() + r*N_MOMENTS;
+      average_record( red, ro/reduce_cells[r], rv/reduce_cells[r] );
+      if ( in_batches )
+        update_batch( red, reduced_mean.data() + r*N_MOMENTS, reduced_m2.data() + r*N_MOMENTS,
+          reduced_err.data() + r*N_MOMENTS, rb, rb1 );
+    }
+  }
+
+  #pragma omp parallel for schedule(static)
+  for (int c = 0; c<nx*ny; ++c)
+  {
+    real_number* rec = record(c);
+    average_record( rec, ro, rv );
+    if ( in_batches )
+      update_batch( rec, batch_mean.data() + c*N_MOMENTS, batch_m2.data() + c*N_MOMENTS,
+        batch_err.data() + c*N_MOMENTS, rb, rb1 );
+  }
+
+  // Velocity distributions: counts of each region over its binned particles
+  for (int r = 0; r<n_regions && n_bins>0; ++r)
+  {
+    const long* hist = vel_hist.data() + r*3*n_bins;
+    long n_binned = 0;
+    for (int b = 0; b<n_bins; ++b)
+      n_binned += hist[b];
+    const real_number norm = n_binned > 0 ? rdv_hist / (double)n_binned : 0.0;
+    for (int d = 0; d<3; ++d)
+      for (int b = 0; b<n_bins; ++b)
+        vdf(b, 1+3*r+d) = hist[d*n_bins+b] * norm;
+    if ( out_of_range[r] > 0 )
+      std::cerr << "[!] " << out_of_range[r] << " particles of region " << r
+        << " beyond the velocity histogram range" << std::endl;
+  }
 
   outer_counter = 0;
 
 }
+
+real_number
+Sampler::relative_error
+(int m) const
+{
+  const real_number eta_g = conf->get_eta_liq0();
+  const real_number eta_l = conf->get_eta_liq1();
+  const real_number margin = AUTOSTOP_INTERFACE_MARGIN * std::abs( eta_l - eta_g );
+  const real_number eta_lo = std::min( eta_g, eta_l ) + margin;
+  const real_number eta_hi = std::max( eta_g, eta_l ) - margin;
+  if ( n_batches < 2 )
+    return std::numeric_limits<real_number>::infinity();
+  const real_number rs = 1.0 / sqrt( (double)n_batches );
+  real_number err_interface = 0.0, err_all = 0.0;
+  bool any_interface = false;
+  const real_number* mean;
+  real_number rel;
+  for (int c = 0; c<nx*ny; ++c)
+  {
+    mean = batch_mean.data() + c*N_MOMENTS;
+    if ( mean[m] == 0.0 )
+      continue;
+    rel = batch_err[c*N_MOMENTS+m] * rs / std::abs( mean[m] );
+    err_all = std::max( err_all, rel );
+    if ( mean[AvetaMoment] > eta_lo && mean[AvetaMoment] < eta_hi )
+    {
+      any_interface = true;
+      err_interface = std::max( err_interface, rel );
+    }
+  }
+  return any_interface ? err_interface : err_all;
+}
+
+bool
+Sampler::converged
+(void) const
+{
+  if ( AUTOSTOP_TOL <= 0.0 || n_batches < AUTOSTOP_MIN_BATCHES )
+    return false;
+  return relative_error(NumdensMoment) < AUTOSTOP_TOL && relative_error(TempMoment) < AUTOSTOP_TOL;
+}
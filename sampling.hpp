@@ -7,6 +7,102 @@
 
 #include "motherbase.hpp"
 #include "matrix.hpp"
+#include "parallel.hpp"
+
+#include <cmath>
+#include <vector>
+
+/*! \def TILED_SAMPLING
+    \brief Sample particles in storage order into private tiles (1) or cell by cell (0)
+*/
+#ifndef TILED_SAMPLING
+#define TILED_SAMPLING 0
+#endif
+
+/*! \def SAMPLE_TILES
+    \brief Number of particle blocks, each with its own accumulator tile, of the tiled sampler
+*/
+#ifndef SAMPLE_TILES
+#define SAMPLE_TILES 8
+#endif
+
+/*! \def AUTOSTOP_TOL
+    \brief Relative standard error of numdens and temp (interface cells) ending the run (0: never)
+*/
+#ifndef AUTOSTOP_TOL
+#define AUTOSTOP_TOL 0.0
+#endif
+
+/*! \def AUTOSTOP_MIN_BATCHES
+    \brief Minimum number of sampling windows before the run may be stopped
+*/
+#ifndef AUTOSTOP_MIN_BATCHES
+#define AUTOSTOP_MIN_BATCHES 5
+#endif
+
+/*! \def AUTOSTOP_INTERFACE_MARGIN
+    \brief Cells within this fraction of eta_liq1-eta_liq0 from either bulk density are not interface
+*/
+#ifndef AUTOSTOP_INTERFACE_MARGIN
+#define AUTOSTOP_INTERFACE_MARGIN 0.1
+#endif
+
+/*! \def SAMPLE_REDUCTION
+    \brief Reduction of the sampled fields for output (see SampleReduction)
+*/
+#ifndef SAMPLE_REDUCTION
+#define SAMPLE_REDUCTION AutoReduction
+#endif
+
+/*! \def HISTOGRAM_N_SIGMA
+    \brief Velocity histograms span +/- this number of thermal speeds sqrt(T_ini/m)
+*/
+#ifndef HISTOGRAM_N_SIGMA
+#define HISTOGRAM_N_SIGMA 6.0
+#endif
+
+/*! \enum SampleMoment
+ *  \brief Position of each sampled quantity within the record of a cell
+ */
+enum SampleMoment
+{
+  CountMoment = 0,    /*!< Number of particles (then per sample)  */
+  VxMoment, VyMoment, VzMoment,
+  TempMoment,
+  PxxMoment, PyyMoment, PzzMoment, PxyMoment, PxzMoment, PyzMoment,
+  QxMoment, QyMoment, QzMoment,
+  NumdensMoment,
+  AvetaMoment,
+  FxMoment, FyMoment,
+  N_MOMENTS
+};
+
+/*! \fn inline const char* moment_name(int)
+ *  \brief Short name of each sampled quantity (used for output)
+ */
+inline const char* moment_name(int m)
+{
+  static const char* names[N_MOMENTS] = { "count", "vx", "vy", "vz", "temp",
+    "pxx", "pyy", "pzz", "pxy", "pxz", "pyz", "qx", "qy", "qz", "numdens", "aveta", "fx", "fy" };
+  return names[m];
+}
+
+/*! \enum SampleReduction
+ *  \brief Reduction of the sampled fields at averaging time
+ */
+enum SampleReduction
+{
+  NoReduction = 0,    /*!< Full grids                                           */
+  ProfileAlongX,      /*!< 1D profiles, function of x (averaged over y)         */
+  ProfileAlongY,      /*!< 1D profiles, function of y (averaged over x)         */
+  SubdomainAverage,   /*!< Averages over the ndom regions of the histograms     */
+  AutoReduction       /*!< Profiles across liquid layers (liq_interf 5, 6), full grids otherwise */
+};
+
+/*! \def N_PARTICLE_MOMENTS
+    \brief Number of leading slots of a record summed over particles (CountMoment ... QzMoment)
+*/
+#define N_PARTICLE_MOMENTS ( QzMoment+1 )
 
 /*! \class Sampler
  *  \brief Class for collecting and averaging samples
@@ -19,36 +115,156 @@
  *    - temperature
  *    - streaming pressure tensor
  *    - heat flux
+ *
+ *  All quantities of a cell are stored in one contiguous record of N_MOMENTS
+ *  values (cells in lexico-graphic order), so that sampling, averaging and
+ *  resetting touch each cell once; fields are exposed as strided views
+ *
+ *  Both sampling modes are thread-parallel and give the same result for any
+ *  number of threads: cell by cell, each record is summed by a single thread;
+ *  in storage order, particles are split in SAMPLE_TILES fixed blocks, summed
+ *  into private tiles, which are then merged by a pairwise tree in fixed order
+ *
+ *  Each averaging window is a batch: mean and variance of the window averages
+ *  are updated online (Welford), giving the error of a window average and of
+ *  the mean over all windows, on which the run can be stopped (AUTOSTOP_TOL);
+ *  only windows of niter_sampling samples are batches, and the statistics are
+ *  restarted at the end of the initial transient (see DEFAULT_TRANSIENT_ITER)
+ *
+ *  In the same pass, the velocity components of particles are binned into Nv
+ *  bins for each of ndom regions (slabs of cells along y by default; any cell
+ *  to region map can be set), giving velocity distributions without dumping
+ *  particles
+ *
+ *  Fields can also be reduced to 1D profiles or subdomain averages: the sums of
+ *  the cells of each profile point (subdomain) are collected before averaging,
+ *  so that reduced values are particle-weighted averages, with their own errors
  */
 class Sampler : protected Motherbase
 {
 
+public:
+
+  typedef Eigen::Map< const Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic>,
+    Eigen::Unaligned, Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> > MomentView;
+
 private:
 
   int outer_counter = 0;
+  const int nx, ny;
+
+  std::vector<real_number> moments;   /*!< Records of N_MOMENTS values for each cell        */
+  std::vector<real_number> tiles;     /*!< SAMPLE_TILES grids of N_PARTICLE_MOMENTS values (tiled mode) */
+
+  // Velocity histograms
+  int n_bins;                           /*!< Number of bins for each velocity component (Nv)    */
+  int n_regions;                        /*!< Number of regions (ndom)                           */
+  real_number v_hist;                   /*!< Histograms span [-v_hist, v_hist)                  */
+  real_number rdv_hist;                 /*!< Inverse of the bin width                           */
+  std::vector<int> cell_region;         /*!< Region of each cell (-1: not binned)               */
+  std::vector<long> vel_hist;           /*!< Counts, indexed ((region*3 + component)*n_bins + bin) */
+  std::vector<long> out_of_range;       /*!< Particles beyond the histogram range, per region   */
+  Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> vdf;  /*!< Normalised histograms (one row per bin) */
+
+  /*! \fn void Sampler::bin_velocity(long*, long*, int, real_number, real_number, real_number) const
+      \brief Adds a particle of the given region to the histograms
+  */
+  inline void bin_velocity(long* hist, long* out, int region, real_number vx, real_number vy, real_number vz) const
+  {
+    int bx = (int)std::floor( ( vx + v_hist ) * rdv_hist );
+    int by = (int)std::floor( ( vy + v_hist ) * rdv_hist );
+    int bz = (int)std::floor( ( vz + v_hist ) * rdv_hist );
+    if ( bx < 0 || bx >= n_bins || by < 0 || by >= n_bins || bz < 0 || bz >= n_bins )
+    {
+      out[region]++;
+      return;
+    }
+    hist += region*3*n_bins;
+    hist[bx]++;
+    hist[n_bins+by]++;
+    hist[2*n_bins+bz]++;
+  }
+
+  /*! \fn void Sampler::merge_histograms(const std::vector<long>&, const std::vector<long>&)
+      \brief Adds histograms collected by a thread (integer counts: the order is irrelevant)
+  */
+  void merge_histograms(const std::vector<long>&, const std::vector<long>&);
+
+  // Reduced fields (same layout as moments, one record per profile point or subdomain)
+  int reduction;                        /*!< Type of reduction (see SampleReduction)            */
+  int n_reduced = 0;                    /*!< Number of reduced records (0: no reduction)        */
+  std::vector<int> reduce_map;          /*!< Reduced record of each cell (-1: none)             */
+  std::vector<int> reduce_cells;        /*!< Number of cells of each reduced record             */
+  std::vector<real_number> reduce_coord;  /*!< Coordinate (or index) of each reduced record     */
+  std::vector<real_number> reduced, reduced_mean, reduced_m2, reduced_err;
+
+  /*! \fn void Sampler::setup_reduction(void)
+      \brief Builds the cell to reduced record map
+  */
+  void setup_reduction(void);
+
+  // Batch statistics (same layout as moments)
+  const int window_length;              /*!< Samples of a window entering the statistics        */
+  int n_batches = 0;                    /*!< Number of averaged windows                         */
+  std::vector<real_number> batch_mean;  /*!< Mean of the window averages                        */
+  std::vector<real_number> batch_m2;    /*!< Sum of squared deviations of the window averages   */
+  std::vector<real_number> batch_err;   /*!< Standard deviation of the window averages          */
+
+  inline real_number* record(int cell) { return moments.data() + cell*N_MOMENTS; }
+
+  /*! \fn void Sampler::sample_fields(void)
+      \brief Accumulates cell fields computed by other classes (force, averaged reduced density)
+  */
+  void sample_fields(void);
+
+  /*! \fn void Sampler::average_record(real_number*, real_number, real_number) const
+      \brief Turns the sums of a record into averages (ro: 1/samples, rv: 1/(samples*volume))
+  */
+  inline void average_record(real_number* rec, real_number ro, real_number rv) const
+  {
+    rec[AvetaMoment] *= ro;
+    rec[FxMoment] *= ro;
+    rec[FyMoment] *= ro;
+    // Only records visited by particles are averaged (the others stay zero)
+    if ( rec[CountMoment] == 0.0 )
+      return;
+    const real_number n = rec[CountMoment];
+    const real_number rn = 1.0 / n;
+    const real_number dtf = n * rv;
+    const real_number vx = rec[VxMoment] * rn;
+    const real_number vy = rec[VyMoment] * rn;
+    const real_number vz = rec[VzMoment] * rn;
+    rec[VxMoment] = vx;
+    rec[VyMoment] = vy;
+    rec[VzMoment] = vz;
+    rec[PxxMoment] = ( rec[PxxMoment]*rn - vx*vx ) * dtf;
+    rec[PyyMoment] = ( rec[PyyMoment]*rn - vy*vy ) * dtf;
+    rec[PzzMoment] = ( rec[PzzMoment]*rn - vz*vz ) * dtf;
+    rec[PxyMoment] = ( rec[PxyMoment]*rn - vx*vy ) * dtf;
+    rec[PxzMoment] = ( rec[PxzMoment]*rn - vx*vz ) * dtf;
+    rec[PyzMoment] = ( rec[PyzMoment]*rn - vy*vz ) * dtf;
+    rec[QxMoment] = rec[QxMoment] * rn * 0.5 * dtf;
+    rec[QyMoment] = rec[QyMoment] * rn * 0.5 * dtf;
+    rec[QzMoment] = rec[QzMoment] * rn * 0.5 * dtf;
+    rec[TempMoment] = ( rec[TempMoment]*rn - vx*vx - vy*vy - vz*vz ) / 3.0;
+    rec[NumdensMoment] = dtf;
+  }
+
+  /*! \fn void Sampler::update_batch(const real_number*, real_number*, real_number*, real_number*, real_number, real_number) const
+      \brief Welford update of the batch statistics of a record (rb: 1/batches, rb1: 1/(batches-1))
+  */
+  inline void update_batch(const real_number* rec, real_number* mean, real_number* m2, real_number* err,
+    real_number rb, real_number rb1) const
+  {
+    for (int m = 0; m<N_MOMENTS; ++m)
+    {
+      real_number delta = rec[m] - mean[m];
+      mean[m] += delta * rb;
+      m2[m] += delta * ( rec[m] - mean[m] );
+      err[m] = sqrt( m2[m] * rb1 );
+    }
+  }
 
-  ev_matrix::MaskMatrix<int> inner_counter;
-  ev_matrix::MaskMatrix<real_number> inner_counter_cast;
-  ev_matrix::MaskMatrix<real_number> dt_factor;
-
-  ev_matrix::MaskMatrix<real_number> vx_avg;
-  ev_matrix::MaskMatrix<real_number> vy_avg;
-  ev_matrix::MaskMatrix<real_number> vz_avg;
-  ev_matrix::MaskMatrix<real_number> temp_avg;
-  ev_matrix::MaskMatrix<real_number> pxx_avg;
-  ev_matrix::MaskMatrix<real_number> pyy_avg;
-  ev_matrix::MaskMatrix<real_number> pzz_avg;
-  ev_matrix::MaskMatrix<real_number> pxy_avg;
-  ev_matrix::MaskMatrix<real_number> pxz_avg;
-  ev_matrix::MaskMatrix<real_number> pyz_avg;
-  ev_matrix::MaskMatrix<real_number> qx_avg;
-  ev_matrix::MaskMatrix<real_number> qy_avg;
-  ev_matrix::MaskMatrix<real_number> qz_avg;
-
-  ev_matrix::MaskMatrix<real_number> numdens_avg;
-  ev_matrix::MaskMatrix<real_number> aveta_avg;
-  ev_matrix::MaskMatrix<real_number> fx_avg;
-  ev_matrix::MaskMatrix<real_number> fy_avg;
 
 public:
 
@@ -57,42 +273,86 @@ public:
 
   void reset(void);
   void sample(void);
+  void sample_cells(void);
+  void sample_tiled(void);
+  void sample_scatter(void);
   void average(void);
+  void reset_statistics(void);
+
+  /*! \fn void Sampler::save_checkpoint(ev_checkpoint::CheckpointWriter&) const
+      \brief Writes the accumulators of the current window and the batch statistics
+  */
+  void save_checkpoint(ev_checkpoint::CheckpointWriter&) const;
+
+  /*! \fn void Sampler::load_checkpoint(ev_checkpoint::CheckpointReader&)
+      \brief Restores the state written by save_checkpoint (sizes have to match the configuration)
+  */
+  void load_checkpoint(ev_checkpoint::CheckpointReader&);
+
+  /*! \fn real_number Sampler::relative_error(int) const
+      \brief Largest relative standard error of the mean over all windows, within interface cells
+
+      Interface cells are the ones whose mean reduced density is farther than
+      AUTOSTOP_INTERFACE_MARGIN*(eta_liq1-eta_liq0) from both bulk densities; if
+      there are none (single phase), all sampled cells are considered
+  */
+  real_number relative_error(int m) const;
+
+  /*! \fn bool Sampler::converged(void) const
+      \brief Whether numdens and temp are known within AUTOSTOP_TOL (never, if AUTOSTOP_TOL is 0)
+  */
+  bool converged(void) const;
+
+  /*! \fn MomentView Sampler::get_moment(int) const
+      \brief View of one quantity over the grid, indexed (i,j) as the other cell fields
+  */
+  inline MomentView get_moment(int m) const
+  {
+    return MomentView( moments.data() + m, nx, ny,
+      Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>( nx*N_MOMENTS, N_MOMENTS ) );
+  }
+
+  /*! \fn MomentView Sampler::get_error(int) const
+      \brief Standard deviation of the window averages of one quantity (error of a window average)
+  */
+  inline MomentView get_error(int m) const
+  {
+    return MomentView( batch_err.data() + m, nx, ny,
+      Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic>( nx*N_MOMENTS, N_MOMENTS ) );
+  }
+
+  inline int get_n_batches(void) const { return n_batches; }
+
+  /*! \fn void Sampler::set_cell_region(const std::vector<int>&)
+      \brief Replaces the default slabs by a map from lexico cell index to region (-1: not binned)
+  */
+  void set_cell_region(const std::vector<int>&);
+  inline bool histograms_enabled(void) const { return n_bins > 0 && n_regions > 0; }
+  inline int get_reduction(void) const { return reduction; }
+
+  /*! \fn Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> Sampler::get_reduced_table(void) const
+      \brief Reduced fields, one row per record: coordinate, N_MOMENTS averages, N_MOMENTS errors
+  */
+  Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic> get_reduced_table(void) const;
+  inline const Eigen::Array<real_number, Eigen::Dynamic, Eigen::Dynamic>& get_vdf(void) const { return vdf; }
 
-  inline const ev_matrix::MaskMatrix<real_number>& get_vx_avg(void) const { return vx_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_vx_avg(void) { return vx_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_vy_avg(void) const { return vy_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_vy_avg(void) { return vy_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_vz_avg(void) const { return vz_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_vz_avg(void) { return vz_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_temp_avg(void) const { return temp_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_temp_avg(void) { return temp_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pxx_avg(void) const { return pxx_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pxx_avg(void) { return pxx_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pyy_avg(void) const { return pyy_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pyy_avg(void) { return pyy_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pzz_avg(void) const { return pzz_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pzz_avg(void) { return pzz_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pxy_avg(void) const { return pxy_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pxy_avg(void) { return pxy_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pxz_avg(void) const { return pxz_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pxz_avg(void) { return pxz_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_pyz_avg(void) const { return pyz_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_pyz_avg(void) { return pyz_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_qx_avg(void) const { return qx_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_qx_avg(void) { return qx_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_qy_avg(void) const { return qy_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_qy_avg(void) { return qy_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_qz_avg(void) const { return qz_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_qz_avg(void) { return qz_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_numdens_avg(void) const { return numdens_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_numdens_avg(void) { return numdens_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_forces_x_avg(void) const { return fx_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_forces_x_avg(void) { return fx_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_forces_y_avg(void) const { return fy_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_forces_y_avg(void) { return fy_avg; }
-  inline const ev_matrix::MaskMatrix<real_number>& get_aveta_avg(void) const { return aveta_avg; }
-  inline ev_matrix::MaskMatrix<real_number>& get_aveta_avg(void) { return aveta_avg; }
+  inline MomentView get_vx_avg(void) const { return get_moment(VxMoment); }
+  inline MomentView get_vy_avg(void) const { return get_moment(VyMoment); }
+  inline MomentView get_vz_avg(void) const { return get_moment(VzMoment); }
+  inline MomentView get_temp_avg(void) const { return get_moment(TempMoment); }
+  inline MomentView get_pxx_avg(void) const { return get_moment(PxxMoment); }
+  inline MomentView get_pyy_avg(void) const { return get_moment(PyyMoment); }
+  inline MomentView get_pzz_avg(void) const { return get_moment(PzzMoment); }
+  inline MomentView get_pxy_avg(void) const { return get_moment(PxyMoment); }
+  inline MomentView get_pxz_avg(void) const { return get_moment(PxzMoment); }
+  inline MomentView get_pyz_avg(void) const { return get_moment(PyzMoment); }
+  inline MomentView get_qx_avg(void) const { return get_moment(QxMoment); }
+  inline MomentView get_qy_avg(void) const { return get_moment(QyMoment); }
+  inline MomentView get_qz_avg(void) const { return get_moment(QzMoment); }
+  inline MomentView get_numdens_avg(void) const { return get_moment(NumdensMoment); }
+  inline MomentView get_forces_x_avg(void) const { return get_moment(FxMoment); }
+  inline MomentView get_forces_y_avg(void) const { return get_moment(FyMoment); }
+  inline MomentView get_aveta_avg(void) const { return get_moment(AvetaMoment); }
 
 };
 
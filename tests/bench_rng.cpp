@@ -0,0 +1,213 @@
+// Throughput and quality benchmark for the random engines of ev_random
+// g++ -std=c++11 -O2 -I../utility bench_rng.cpp -o bench_rng
+// ./bench_rng [n_samples]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+
+#include "random.hpp"
+#include "types.hpp"
+
+using namespace ev_random;
+
+const int N_BINS = 100;   // Bins for the chi-square test on uniforms
+const real_number N_SD = 5.0;   // Tolerance on moments (standard errors)
+int n_fail = 0;
+
+// Timing
+typedef std::chrono::steady_clock Clock;
+inline real_number elapsed_ns(Clock::time_point t0, std::size_t n)
+{
+  return std::chrono::duration<real_number, std::nano>( Clock::now() - t0 ).count() / n;
+}
+
+// Quality checks print a compact verdict, failures are listed at the end
+std::vector<std::string> failures;
+std::string verdict(const std::string& engine, const std::string& name, bool ok)
+{
+  if ( !ok )
+  {
+    n_fail++;
+    failures.push_back( engine + ": " + name );
+  }
+  return ok ? "ok" : "FAIL";
+}
+
+/*! \fn std::string check_uniform(const std::string&, const std::vector<real_number>&)
+ *  \brief Moments, chi-square on N_BINS bins and lag-1 serial correlation of uniforms
+ */
+std::string check_uniform(const std::string& engine, const std::vector<real_number>& u)
+{
+  const real_number n = u.size();
+  real_number mean = 0.0, m2 = 0.0, lag = 0.0;
+  std::vector<real_number> bins(N_BINS, 0.0);
+  bool in_range = true;
+  for (std::size_t m = 0; m<u.size(); ++m)
+  {
+    in_range = in_range && u[m] >= 0.0 && u[m] < 1.0;
+    mean += u[m];
+    m2 += u[m]*u[m];
+    if ( m > 0 ) lag += ( u[m]-0.5 ) * ( u[m-1]-0.5 );
+    bins[ std::min( (int)( u[m]*N_BINS ), N_BINS-1 ) ] += 1.0;
+  }
+  mean /= n;
+  real_number var = m2/n - mean*mean;
+  real_number corr = 12.0 * lag / ( n-1.0 );
+  real_number chi2 = 0.0, expected = n / N_BINS;
+  for (int b = 0; b<N_BINS; ++b)
+    chi2 += ( bins[b]-expected ) * ( bins[b]-expected ) / expected;
+  // chi2 with N_BINS-1 degrees of freedom: mean 99, std 14
+  real_number chi2_tol = (N_BINS-1) + N_SD * sqrt( 2.0*(N_BINS-1) );
+  std::ostringstream out;
+  out << std::setprecision(4)
+    << "range " << verdict( engine, "range", in_range )
+    << " | mean " << mean << " " << verdict( engine, "uniform mean", std::abs(mean-0.5) < N_SD*sqrt(1.0/(12.0*n)) )
+    << " | var " << var << " " << verdict( engine, "uniform variance", std::abs(var-1.0/12.0) < N_SD*sqrt(1.0/(180.0*n)) )
+    << " | chi2 " << chi2 << " " << verdict( engine, "chi-square", chi2 < chi2_tol )
+    << " | corr " << corr << " " << verdict( engine, "serial correlation", std::abs(corr) < N_SD/sqrt(n) );
+  return out.str();
+}
+
+/*! \fn std::string check_normal(const std::string&, const std::string&, const std::vector<real_number>&)
+ *  \brief Moments of standard normal variates
+ */
+std::string check_normal(const std::string& engine, const std::string& sampler, const std::vector<real_number>& g)
+{
+  const real_number n = g.size();
+  real_number mean = 0.0, m2 = 0.0, m4 = 0.0;
+  for (std::size_t m = 0; m<g.size(); ++m)
+  {
+    mean += g[m];
+    m2 += g[m]*g[m];
+    m4 += g[m]*g[m]*g[m]*g[m];
+  }
+  mean /= n; m2 /= n; m4 /= n;
+  std::ostringstream out;
+  out << std::setprecision(4)
+    << "mean " << mean << " " << verdict( engine, sampler+" mean", std::abs(mean) < N_SD/sqrt(n) )
+    << " | <g^2> " << m2 << " " << verdict( engine, sampler+" variance", std::abs(m2-1.0) < N_SD*sqrt(2.0/n) )
+    << " | <g^4> " << m4 << " " << verdict( engine, sampler+" 4th moment", std::abs(m4-3.0) < N_SD*sqrt(96.0/n) );
+  return out.str();
+}
+
+/*! \fn std::string check_sphere(const std::string&, const std::string&, ...)
+ *  \brief Norm and moments of unit vectors (each component uniform in [-1,1])
+ */
+std::string check_sphere(const std::string& engine, const std::string& sampler, const std::vector<real_number>& kx,
+  const std::vector<real_number>& ky, const std::vector<real_number>& kz)
+{
+  const real_number n = kx.size();
+  real_number err = 0.0, mz = 0.0, mz2 = 0.0, mxy = 0.0;
+  for (std::size_t m = 0; m<kx.size(); ++m)
+  {
+    err = std::max( err, std::abs( kx[m]*kx[m] + ky[m]*ky[m] + kz[m]*kz[m] - 1.0 ) );
+    mz += kz[m];
+    mz2 += kz[m]*kz[m];
+    mxy += kx[m]*ky[m];
+  }
+  mz /= n; mz2 /= n; mxy /= n;
+  std::ostringstream out;
+  out << std::setprecision(4)
+    << "norm err " << err << " " << verdict( engine, sampler+" norm", err < 1e-14 )
+    << " | <kz> " << mz << " " << verdict( engine, sampler+" <kz>", std::abs(mz) < N_SD*sqrt(1.0/(3.0*n)) )
+    << " | <kz^2> " << mz2 << " " << verdict( engine, sampler+" <kz^2>", std::abs(mz2-1.0/3.0) < N_SD*sqrt(4.0/(45.0*n)) )
+    << " | <kx ky> " << mxy << " " << verdict( engine, sampler+" <kx ky>", std::abs(mxy) < N_SD*sqrt(1.0/(15.0*n)) );
+  return out.str();
+}
+
+/*! \fn void bench(const std::string&, Engine&, std::size_t)
+ *  \brief Times and checks all samplers of an engine
+ */
+template <class Engine>
+void bench(const std::string& engine_name, Engine& rng, std::size_t n)
+{
+  RngAbstract& rng_virtual = rng;
+  std::vector<real_number> u(n), vx(n), vy(n), vz(n);
+  Clock::time_point t0;
+  real_number sink = 0.0;
+
+  std::cout << "### " << engine_name << " ###" << std::endl;
+  std::cout << std::fixed << std::setprecision(2);
+
+  // Uniforms
+  t0 = Clock::now();
+  for (std::size_t m = 0; m<n; ++m)
+    u[m] = rng_virtual.sample_uniform();
+  real_number t_virtual = elapsed_ns(t0, n);
+  t0 = Clock::now();
+  for (std::size_t m = 0; m<n; ++m)
+    u[m] = rng.Engine::sample_uniform();
+  real_number t_inline = elapsed_ns(t0, n);
+  sink += u[n/2];
+  t0 = Clock::now();
+  rng.fill_uniform(u.data(), n);
+  real_number t_fill = elapsed_ns(t0, n);
+  std::cout << " >> uniform       [ns/sample] virtual " << t_virtual << "\tinline " << t_inline
+    << "\tfill_uniform " << t_fill << std::endl;
+  std::cout << std::defaultfloat << "    " << check_uniform( engine_name, u ) << std::fixed << std::endl;
+
+  // Normals (per component, i.e. 3 per velocity)
+  t0 = Clock::now();
+  for (std::size_t m = 0; m<n; ++m)
+    rng_virtual.sample_box_muller(1.0, 0.0, 0.0, 1.0, vx[m], vy[m], vz[m]);
+  real_number t_bm = elapsed_ns(t0, 3*n);
+  std::string bm_check = check_normal( engine_name, "sample_box_muller", vz );
+  t0 = Clock::now();
+  rng.fill_maxwellian(1.0, 1.0, 0.0, 0.0, vx.data(), vy.data(), vz.data(), n);
+  real_number t_mw = elapsed_ns(t0, 3*n);
+  std::cout << " >> normal        [ns/sample] sample_box_muller " << t_bm << "\tfill_maxwellian " << t_mw << std::endl;
+  std::cout << std::defaultfloat << "    " << bm_check << std::endl;
+  std::cout << "    " << check_normal( engine_name, "fill_maxwellian", vx ) << std::fixed << std::endl;
+
+  // Unit vectors
+  t0 = Clock::now();
+  for (std::size_t m = 0; m<n; ++m)
+    rng_virtual.sample_unit_sphere(vx[m], vy[m], vz[m]);
+  real_number t_sph = elapsed_ns(t0, n);
+  std::vector<real_number> kx(vx), ky(vy), kz(vz);
+  std::cout << " >> unit sphere   [ns/vector] sample_unit_sphere " << t_sph;
+  t0 = Clock::now();
+  rng.fill_unit_sphere(vx.data(), vy.data(), vz.data(), n);
+  real_number t_fsph = elapsed_ns(t0, n);
+  std::cout << "\tfill_unit_sphere " << t_fsph << std::endl;
+  std::cout << std::defaultfloat << "    " << check_sphere( engine_name, "sample_unit_sphere", kx, ky, kz ) << std::endl;
+  std::cout << "    " << check_sphere( engine_name, "fill_unit_sphere", vx, vy, vz ) << std::endl;
+
+  if ( sink == 42.0 ) std::cout << std::endl;
+}
+
+template <RngType type>
+void bench_custom(const std::string& engine_name, std::size_t n)
+{
+  CustomRngObject<type> rng(12345);
+  bench(engine_name, rng, n);
+}
+
+int main(int argc, char** argv)
+{
+
+std::size_t n = ( argc > 1 ) ? std::atol( argv[1] ) : 2000000;
+std::cout << "### RNG BENCHMARK: " << n << " SAMPLES PER TEST ###" << std::endl;
+
+StdRngObject<std::mt19937_64> mt(12345);
+bench("std::mt19937_64", mt, n);
+bench_custom<Knuth>("Knuth", n);
+bench_custom<ParkMiller>("ParkMiller", n);
+bench_custom<Marsiglia>("Marsiglia", n);
+bench_custom<Splitmix>("Splitmix", n);
+bench_custom<Xorshift64>("Xorshift64", n);
+bench_custom<Philox>("Philox", n);
+bench_custom<Xoshiro256>("Xoshiro256", n);
+
+std::cout << "### FAILED CHECKS: " << n_fail << " ###" << std::endl;
+for (auto it = failures.cbegin(); it!=failures.cend(); ++it)
+  std::cout << " >> " << *it << std::endl;
+return n_fail == 0 ? 0 : 1;
+
+}
@@ -0,0 +1,31 @@
+/*! \file check.hpp
+ *  \brief Pass/fail checks of sample estimates, shared by the tests
+ */
+
+#ifndef EV_TESTS_CHECK_HPP
+#define EV_TESTS_CHECK_HPP
+
+#include <iostream>
+#include <cmath>
+
+#include "types.hpp"
+
+static int n_fail = 0;
+
+// Checks a sample estimate against its exact value, within n_sd standard errors
+static void check(const char* name, real_number estimate, real_number exact, real_number std_err, real_number n_sd = 5.0)
+{
+  bool ok = std::abs( estimate - exact ) <= n_sd * std_err;
+  if ( !ok ) n_fail++;
+  std::cout << ( ok ? "[ OK ] " : "[FAIL] " ) << name << " = " << estimate
+    << " (exact " << exact << ", tol " << n_sd * std_err << ")" << std::endl;
+}
+
+// Prints the outcome of all checks, returns the exit status of the test
+static int report(void)
+{
+  std::cout << ( n_fail == 0 ? "ALL TESTS PASSED" : "SOME TESTS FAILED" ) << std::endl;
+  return n_fail == 0 ? 0 : 1;
+}
+
+#endif /* EV_TESTS_CHECK_HPP */
@@ -0,0 +1,66 @@
+// Collision routines test: the Poisson routine must give the same mean number of candidates
+// and of real collisions per cell as the majorant routine, with a Poisson variance
+// g++ -std=c++11 -O2 -I.. -I../utility -I<eigen> test_collision_routines.cpp -o test_collision_routines
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "collisions.hpp"
+#include "check.hpp"
+
+// Mean and variance of the candidates and of the real collisions of a cell over n_steps
+struct CellStats
+{
+  real_number cand_mean = 0.0, cand_var = 0.0;
+  real_number real_mean = 0.0, real_var = 0.0;
+};
+
+// Candidates are accepted with probability u1*u2 (in place of g.k/(vrmax*sigma) * n chi/a11)
+CellStats run_cell(AbstractCollisionRoutine& routine, real_number expected, int n_steps,
+  DSMC::RandomEngine& rng)
+{
+  CellStats st;
+  real_number sc = 0.0, sc2 = 0.0, sr = 0.0, sr2 = 0.0;
+  for (int s = 0; s<n_steps; ++s)
+  {
+    int n = routine.draw_candidates( expected, rng );
+    int n_real = 0;
+    for (int m = 0; m<n; ++m)
+      if ( rng.sample_uniform() < rng.sample_uniform() * rng.sample_uniform() )
+        n_real++;
+    sc += n; sc2 += (real_number)n*n;
+    sr += n_real; sr2 += (real_number)n_real*n_real;
+  }
+  st.cand_mean = sc / n_steps;
+  st.cand_var = sc2 / n_steps - st.cand_mean*st.cand_mean;
+  st.real_mean = sr / n_steps;
+  st.real_var = sr2 / n_steps - st.real_mean*st.real_mean;
+  return st;
+}
+
+int main()
+{
+
+const int N = 200000;
+DSMC::RandomEngine rng(12345);
+CollisionRoutine<MajorantScheme> majorant;
+CollisionRoutine<PoissonScheme> poisson;
+
+// Expected candidates per cell, from almost empty to crowded cells
+const real_number expected[] = { 0.3, 2.5, 3.5, 9.0, 40.0, 900.0 };
+for (int c = 0; c<6; ++c)
+{
+  std::cout << "### CELL: expected = " << expected[c] << " ###" << std::endl;
+  CellStats mj = run_cell( majorant, expected[c], N, rng );
+  CellStats ps = run_cell( poisson, expected[c], N, rng );
+  check( " >> poisson <candidates>", ps.cand_mean, expected[c], sqrt( ps.cand_var/N ) );
+  check( " >> poisson <real> - majorant <real>", ps.real_mean - mj.real_mean, 0.0,
+    sqrt( ( ps.real_var + mj.real_var )/N ) );
+  check( " >> poisson var(candidates)", ps.cand_var, expected[c],
+    sqrt( ( expected[c] + 2.0*expected[c]*expected[c] )/N ) );
+}
+
+return report();
+
+}
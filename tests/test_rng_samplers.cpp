@@ -0,0 +1,75 @@
+// Accuracy test for the batch samplers of ev_random (moments against exact values)
+// g++ -std=c++11 -O2 -I../utility test_rng_samplers.cpp -o test_rng_samplers
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+
+#include "random.hpp"
+#include "types.hpp"
+#include "check.hpp"
+
+// Central moment of order p
+real_number moment(const std::vector<real_number>& x, real_number mean, int p)
+{
+  real_number s = 0.0;
+  for (std::size_t m = 0; m<x.size(); ++m)
+    s += std::pow( x[m]-mean, p );
+  return s / x.size();
+}
+
+int main()
+{
+
+const int N = 1000000;
+ev_random::CustomRngObject<RNG> rng(12345);
+
+// MAXWELLIAN
+// Odd size on purpose: only one variate of the last pair is used
+const real_number mass = 2.0, T = 0.7, ux = 0.3, uy = -0.1;
+const real_number var = T / mass;
+std::vector<real_number> vx(N+1), vy(N+1), vz(N+1);
+rng.fill_maxwellian( mass, T, ux, uy, vx.data(), vy.data(), vz.data(), N+1 );
+const real_number u[3] = { ux, uy, 0.0 };
+const std::vector<real_number>* v[3] = { &vx, &vy, &vz };
+const char* comp[3] = { "x", "y", "z" };
+for (int d = 0; d<3; ++d)
+{
+  real_number n = v[d]->size();
+  std::cout << "### MAXWELLIAN, COMPONENT " << comp[d] << " ###" << std::endl;
+  real_number mean = moment( *v[d], 0.0, 1 );
+  check( " >> mean", mean, u[d], sqrt( var/n ) );
+  check( " >> variance", moment( *v[d], u[d], 2 ), var, var*sqrt( 2.0/n ) );
+  check( " >> 3rd moment", moment( *v[d], u[d], 3 ), 0.0, var*sqrt( 15.0*var/n ) );
+  check( " >> 4th moment", moment( *v[d], u[d], 4 ), 3.0*var*var, var*var*sqrt( 96.0/n ) );
+}
+real_number cxy = 0.0;
+for (int m = 0; m<N+1; ++m)
+  cxy += ( vx[m]-ux ) * ( vy[m]-uy );
+check( " >> <cx cy>", cxy/(N+1), 0.0, var/sqrt( N+1.0 ) );
+
+// UNIT SPHERE
+std::vector<real_number> kx(N), ky(N), kz(N);
+rng.fill_unit_sphere( kx.data(), ky.data(), kz.data(), N );
+real_number max_err = 0.0;
+for (int m = 0; m<N; ++m)
+  max_err = std::max( max_err, std::abs( kx[m]*kx[m] + ky[m]*ky[m] + kz[m]*kz[m] - 1.0 ) );
+std::cout << "### UNIT SPHERE ###" << std::endl;
+check( " >> max | |k|^2 - 1 |", max_err, 0.0, 1e-15, 10.0 );
+const std::vector<real_number>* k[3] = { &kx, &ky, &kz };
+for (int d = 0; d<3; ++d)
+{
+  // Each component is uniform in [-1,1]: <k^2> = 1/3, <k^4> = 1/5
+  std::cout << " (component " << comp[d] << ")" << std::endl;
+  check( " >> <k>", moment( *k[d], 0.0, 1 ), 0.0, sqrt( 1.0/(3.0*N) ) );
+  check( " >> <k^2>", moment( *k[d], 0.0, 2 ), 1.0/3.0, sqrt( (1.0/5.0 - 1.0/9.0)/N ) );
+  check( " >> <k^4>", moment( *k[d], 0.0, 4 ), 1.0/5.0, sqrt( (1.0/9.0 - 1.0/25.0)/N ) );
+}
+real_number kxy = 0.0;
+for (int m = 0; m<N; ++m)
+  kxy += kx[m] * ky[m];
+check( " >> <kx ky>", kxy/N, 0.0, sqrt( 1.0/(15.0*N) ) );
+
+return report();
+
+}
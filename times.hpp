@@ -50,6 +50,9 @@ public:
 
   const real_number& get_delta_t(void) const { return delta_t; }
 
+  // Other modules keep a reference to delta_t: tests may shorten the step temporarily
+  void set_delta_t(real_number _delta_t_) { delta_t = _delta_t_; }
+
   const real_number get_tc(int i) const { return tc[i]; }
 
 };
@@ -0,0 +1,62 @@
+// Extracts fields from a time-series store of the sampled fields (see utility/timeseries.hpp)
+// g++ -std=c++11 -O2 -I../utility -I<eigen3> series_extract.cpp -o series_extract
+// ./series_extract <series.evts>                   lists records and fields
+// ./series_extract <series.evts> <field>           one line per record: step, time, field (row by row)
+// ./series_extract <series.evts> <field> <i> <j>   one line per record: step, time, field(i,j)
+// The store is only mapped (read-only), hence it can be read while the run appends to it
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "timeseries.hpp"
+
+int main(int argc, char** argv)
+{
+
+if ( argc < 2 )
+{
+  std::cerr << "[!] Usage: " << argv[0] << " <series.evts> [field [i j]]" << std::endl;
+  return 1;
+}
+
+try
+{
+  ev_snapshot::TimeSeriesReader series(argv[1]);
+  uint64_t n_records = series.get_n_records();
+  if ( argc == 2 )
+  {
+    const ev_snapshot::Geometry& geometry = series.get_geometry();
+    std::cout << "### TIME SERIES " << argv[1] << " ###" << std::endl;
+    std::cout << " >> grid: " << geometry.nx << "x" << geometry.ny << " cells, x in [" << geometry.x_min << ", "
+      << geometry.x_max << "], y in [" << geometry.y_min << ", " << geometry.y_max << "]" << std::endl;
+    std::cout << " >> records: " << n_records;
+    if ( n_records > 0 )
+      std::cout << " (steps " << series.get_entry(0).step << " to " << series.get_entry(n_records-1).step << ")";
+    std::cout << std::endl;
+    for (std::size_t f = 0; f<series.get_names().size(); ++f)
+      std::cout << " >> " << series.get_names()[f] << " (" << series.get_rows(f) << "x" << series.get_cols(f)
+        << ")" << std::endl;
+    return 0;
+  }
+  std::size_t f = series.find_field(argv[2]);
+  for (uint64_t k = 0; k<n_records; ++k)
+  {
+    ev_snapshot::TimeSeriesReader::FieldView field = series.get_field(k, f);
+    std::cout << series.get_entry(k).step << " " << series.get_entry(k).time;
+    if ( argc > 4 )
+      std::cout << " " << field( std::atoi(argv[3]), std::atoi(argv[4]) );
+    else
+      for (Eigen::Index m = 0; m<field.size(); ++m)
+        std::cout << " " << field.data()[m];
+    std::cout << "\n";
+  }
+}
+catch (const char* error)
+{
+  std::cerr << "[!] " << error << std::endl;
+  return 1;
+}
+return 0;
+
+}
@@ -0,0 +1,49 @@
+// Converts a binary snapshot of the sampled fields (see utility/snapshot.hpp) back to text
+// g++ -std=c++11 -O2 -I../utility -I<eigen3> snapshot_to_text.cpp -o snapshot_to_text
+// ./snapshot_to_text <snapshot.evs> [prefix]
+// Each field is written to <prefix>_<name>.txt, in the format of Output::output_sample;
+// the prefix defaults to the snapshot file name without extension
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include "snapshot.hpp"
+
+int main(int argc, char** argv)
+{
+
+if ( argc < 2 )
+{
+  std::cerr << "[!] Usage: " << argv[0] << " <snapshot.evs> [prefix]" << std::endl;
+  return 1;
+}
+std::string file_name = argv[1];
+std::string prefix = ( argc > 2 ) ? argv[2] : file_name.substr( 0, file_name.rfind(".evs") );
+
+try
+{
+  ev_snapshot::SnapshotReader snapshot(file_name);
+  const ev_snapshot::Geometry& geometry = snapshot.get_geometry();
+  std::cout << "### SNAPSHOT " << file_name << " ###" << std::endl;
+  std::cout << " >> grid: " << geometry.nx << "x" << geometry.ny << " cells, x in [" << geometry.x_min << ", "
+    << geometry.x_max << "], y in [" << geometry.y_min << ", " << geometry.y_max << "]" << std::endl;
+  std::cout << " >> step: " << geometry.step << ", time: " << geometry.time << std::endl;
+  for (std::size_t f = 0; f<snapshot.get_n_fields(); ++f)
+  {
+    const ev_snapshot::Field& field = snapshot.get_field(f);
+    std::string out_name = prefix + "_" + snapshot.get_names()[f] + ".txt";
+    std::cout << " >> " << snapshot.get_names()[f] << " (" << field.rows() << "x" << field.cols() << ") -> "
+      << out_name << std::endl;
+    std::ofstream out(out_name);
+    out << field;
+  }
+}
+catch (const char* error)
+{
+  std::cerr << "[!] " << error << std::endl;
+  return 1;
+}
+return 0;
+
+}
@@ -0,0 +1,224 @@
+/*! \file async_writer.hpp
+ *  \brief Header containing a background writer for binary snapshots
+ *
+ *  The simulation hands over a filled snapshot (ownership is moved, no further
+ *  copies) and continues; a worker thread serializes and writes it to disk.
+ *  At most `depth` snapshots wait in the queue: with depth 1 one buffer is
+ *  written while the next one is filled (double buffering); when the queue is
+ *  full the caller blocks until the worker frees a slot (back-pressure)
+ *
+ *  Each snapshot goes either to its own file or to the time-series store
+ *  (see timeseries.hpp), which the worker opens at the first append
+ */
+
+#ifndef EV_ASYNC_WRITER_HPP
+#define EV_ASYNC_WRITER_HPP
+
+#include "snapshot.hpp"
+#include "timeseries.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+/*! \def ASYNC_QUEUE_DEPTH
+    \brief Maximum number of snapshots waiting to be written (0 = synchronous writes)
+*/
+#ifndef ASYNC_QUEUE_DEPTH
+#define ASYNC_QUEUE_DEPTH 1
+#endif
+
+/*! \def SNAPSHOT_COMPRESSION
+    \brief Compression stages of snapshot files (mask of ev_compress::CompressionStage, 0 = raw);
+    e.g. 7 = XOR-delta + shuffle + LZ (not applied to the time-series store)
+*/
+#ifndef SNAPSHOT_COMPRESSION
+#define SNAPSHOT_COMPRESSION 0
+#endif
+
+/*! \def SNAPSHOT_KEYFRAME
+    \brief Every SNAPSHOT_KEYFRAME snapshots, one is compressed without delta
+*/
+#ifndef SNAPSHOT_KEYFRAME
+#define SNAPSHOT_KEYFRAME 10
+#endif
+
+namespace ev_snapshot
+{
+
+/*! \class AsyncWriter
+ *  \brief Bounded queue of snapshots, written to disk by a worker thread
+ */
+class AsyncWriter
+{
+
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+
+  struct Job
+  {
+    SnapshotWriter snapshot;
+    std::string file_name;
+    bool to_series;         /*!< Append to the store named file_name */
+  };
+
+  const std::size_t depth;          /*!< Maximum number of queued snapshots         */
+  std::deque<Job> queue;            /*!< Snapshots waiting to be written            */
+  bool busy = false;                /*!< The worker is writing a snapshot           */
+  bool stopping = false;            /*!< The worker has to exit once queue is empty */
+  std::mutex mutex;
+  std::condition_variable job_ready, slot_free;
+  std::thread worker;
+  std::unique_ptr<TimeSeriesWriter> series;   /*!< Time-series store (opened on first use) */
+  SnapshotCompressor compressor;              /*!< Compression of snapshot files (if enabled) */
+
+  // Statistics
+  int n_pushed = 0;                 /*!< Snapshots handed over                          */
+  int n_written = 0;                /*!< Snapshots written to disk                      */
+  int n_stalls = 0;                 /*!< Hand-overs that found the queue full           */
+  std::size_t max_queued = 0;       /*!< Largest queue length observed                  */
+  double stall_time = 0.0;          /*!< Time the simulation waited for a free slot [s] */
+  double write_time = 0.0;          /*!< Time spent by the worker writing [s]           */
+
+  static double seconds(Clock::time_point t0)
+  {
+    return std::chrono::duration<double>( Clock::now() - t0 ).count();
+  }
+
+  /*! \fn void AsyncWriter::write(const Job&)
+   *  \brief Writes a snapshot to its file, or appends it to the store
+   */
+  void write(const Job& job)
+  {
+    if ( !job.to_series )
+    {
+      if ( compressor.get_stages() != ev_compress::NoCompression )
+        job.snapshot.write(job.file_name, compressor);
+      else
+        job.snapshot.write(job.file_name);
+      return;
+    }
+    if ( !series )
+      series.reset( new TimeSeriesWriter(job.file_name) );
+    series->append(job.snapshot);
+  }
+
+  /*! \fn void AsyncWriter::run(void)
+   *  \brief Worker loop: writes queued snapshots in order, until stopped
+   */
+  void run(void)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ( true )
+    {
+      job_ready.wait( lock, [this]{ return stopping || !queue.empty(); } );
+      if ( queue.empty() )
+        return;
+      Job job = std::move( queue.front() );
+      queue.pop_front();
+      busy = true;
+      slot_free.notify_all();
+      lock.unlock();
+      Clock::time_point t0 = Clock::now();
+      try
+      {
+        write(job);
+      }
+      catch (const char* error)
+      {
+        std::cerr << "[!] " << error << " (" << job.file_name << ")" << std::endl;
+      }
+      double elapsed = seconds(t0);
+      lock.lock();
+      write_time += elapsed;
+      n_written++;
+      busy = false;
+      slot_free.notify_all();
+    }
+  }
+
+public:
+
+  AsyncWriter(std::size_t depth_ = ASYNC_QUEUE_DEPTH, int stages = SNAPSHOT_COMPRESSION):
+    depth(depth_), compressor(stages, SNAPSHOT_KEYFRAME)
+  {
+    if ( depth > 0 )
+      worker = std::thread(&AsyncWriter::run, this);
+  }
+
+  ~AsyncWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    if ( worker.joinable() )
+      worker.join();
+  }
+
+  AsyncWriter(const AsyncWriter&) = delete;
+  AsyncWriter& operator=(const AsyncWriter&) = delete;
+
+  /*! \fn void AsyncWriter::push(SnapshotWriter&&, const std::string&, bool)
+   *  \brief Hands a snapshot over to the worker (blocks while the queue is full)
+   */
+  void push(SnapshotWriter&& snapshot, const std::string& file_name, bool to_series = false)
+  {
+    if ( depth == 0 )
+    {
+      Clock::time_point t0 = Clock::now();
+      write( Job{ std::move(snapshot), file_name, to_series } );
+      write_time += seconds(t0);
+      stall_time = write_time;
+      n_pushed++;
+      n_written++;
+      return;
+    }
+    std::unique_lock<std::mutex> lock(mutex);
+    n_pushed++;
+    if ( queue.size() >= depth )
+    {
+      n_stalls++;
+      Clock::time_point t0 = Clock::now();
+      slot_free.wait( lock, [this]{ return queue.size() < depth; } );
+      stall_time += seconds(t0);
+    }
+    queue.push_back( Job{ std::move(snapshot), file_name, to_series } );
+    max_queued = std::max( max_queued, queue.size() );
+    job_ready.notify_one();
+  }
+
+  /*! \fn void AsyncWriter::flush(void)
+   *  \brief Waits until all snapshots handed over so far are on disk
+   */
+  void flush(void)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    slot_free.wait( lock, [this]{ return queue.empty() && !busy; } );
+  }
+
+  // GETTERS (call after flush for consistent values)
+  inline std::size_t get_depth(void) const { return depth; }
+  inline int get_n_pushed(void) const { return n_pushed; }
+  inline int get_n_written(void) const { return n_written; }
+  inline int get_n_stalls(void) const { return n_stalls; }
+  inline std::size_t get_max_queued(void) const { return max_queued; }
+  inline double get_stall_time(void) const { return stall_time; }
+  inline double get_write_time(void) const { return write_time; }
+  inline const SnapshotCompressor& get_compressor(void) const { return compressor; }
+
+};
+
+} /* namespace ev_snapshot */
+
+#endif /* EV_ASYNC_WRITER_HPP */
@@ -0,0 +1,463 @@
+/*! \file checkpoint.hpp
+ *  \brief Header containing a binary container for the full state of a simulation
+ *
+ *  A checkpoint holds everything needed to continue a run bit for bit: each
+ *  class writes its own section (tag, followed by its raw members), and reads it
+ *  back in the same order. Values are stored in host order, a checkpoint is meant
+ *  to be restarted on the same machine (or one with the same byte order). Layout:
+ *
+ *    char[8]   magic "EVCKPT01"
+ *    uint32    byte-order mark 0x01020304
+ *    for each section:
+ *      uint32  length of the tag, followed by the tag (no terminator)
+ *      ...     the data of the section
+ *
+ *  Vectors are preceded by their size (uint64), arrays by rows and cols (int32)
+ *
+ *  The file is written to a temporary name and then renamed, hence a crash while
+ *  writing never leaves a truncated checkpoint in place of the previous one
+ *
+ *  The simulation only copies its state into a staging buffer (the image), which
+ *  AsyncCheckpointWriter writes to disk from a worker thread while the run goes on
+ */
+
+#ifndef EV_CHECKPOINT_HPP
+#define EV_CHECKPOINT_HPP
+
+#include <Eigen/Dense>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*! \def CHECKPOINT_ASYNC
+    \brief If 1, checkpoint images are written by a worker thread (0 = from the simulation)
+*/
+#ifndef CHECKPOINT_ASYNC
+#define CHECKPOINT_ASYNC 1
+#endif
+
+/*! \namespace ev_checkpoint
+ *  \brief A namespace containing the checkpoint writer and reader
+ */
+namespace ev_checkpoint
+{
+
+const char MAGIC[8] = { 'E', 'V', 'C', 'K', 'P', 'T', '0', '1' };
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+/*! \class AppendBuffer
+ *  \brief Stream buffer appending to a vector (raw writes are a single insert)
+ */
+class AppendBuffer : public std::streambuf
+{
+
+private:
+
+  std::vector<char>& data;
+
+protected:
+
+  virtual int_type overflow(int_type c) override
+  {
+    if ( !traits_type::eq_int_type(c, traits_type::eof()) )
+      data.push_back( traits_type::to_char_type(c) );
+    return traits_type::not_eof(c);
+  }
+
+  virtual std::streamsize xsputn(const char* s, std::streamsize n) override
+  {
+    data.insert(data.end(), s, s+n);
+    return n;
+  }
+
+public:
+
+  AppendBuffer(std::vector<char>& data_): data(data_) { }
+
+};
+
+/*! \fn inline void write_file(const std::vector<char>&, const std::string&)
+ *  \brief Writes a checkpoint image to file (through a temporary file)
+ *
+ *  The temporary file is flushed to disk before it replaces the previous
+ *  checkpoint, and the directory after the rename, so that a crash leaves
+ *  either the old or the new checkpoint on disk, never a truncated one
+ */
+inline void write_file(const std::vector<char>& image, const std::string& file_name)
+{
+  const std::string tmp_name = file_name + ".tmp";
+  int fd = ::open(tmp_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if ( fd < 0 )
+    throw "CheckpointWriter: cannot open file";
+  const char* data = image.data();
+  std::size_t left = image.size();
+  while ( left > 0 )
+  {
+    ssize_t n = ::write(fd, data, left);
+    if ( n < 0 && errno == EINTR )
+      continue;
+    if ( n <= 0 )
+    {
+      ::close(fd);
+      throw "CheckpointWriter: write failed";
+    }
+    data += n;
+    left -= n;
+  }
+  if ( ::fsync(fd) != 0 )
+  {
+    ::close(fd);
+    throw "CheckpointWriter: cannot flush file to disk";
+  }
+  if ( ::close(fd) != 0 )
+    throw "CheckpointWriter: write failed";
+  if ( std::rename(tmp_name.c_str(), file_name.c_str()) != 0 )
+    throw "CheckpointWriter: cannot replace the previous checkpoint";
+  // Persist the rename itself (best effort: not every file system allows it)
+  std::string::size_type slash = file_name.find_last_of('/');
+  const std::string dir_name = ( slash == std::string::npos ) ? "." : file_name.substr(0, slash+1);
+  int dir_fd = ::open(dir_name.c_str(), O_RDONLY);
+  if ( dir_fd >= 0 )
+  {
+    ::fsync(dir_fd);
+    ::close(dir_fd);
+  }
+}
+
+/*! \class CheckpointWriter
+ *  \brief Collects the sections of a checkpoint into a staging buffer (the image)
+ *
+ *  Filling the image only copies memory; a staging buffer handed back by
+ *  AsyncCheckpointWriter keeps its capacity, hence no allocation takes place
+ *  after the first checkpoint
+ */
+class CheckpointWriter
+{
+
+private:
+
+  std::vector<char> image;
+  AppendBuffer append;
+  std::ostream out;
+
+public:
+
+  CheckpointWriter(std::vector<char>&& staging = std::vector<char>()):
+    image( std::move(staging) ), append(image), out(&append)
+  {
+    image.clear();
+    out.write(MAGIC, sizeof(MAGIC));
+    put(BYTE_ORDER_MARK);
+  }
+
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  /*! \fn void CheckpointWriter::section(const std::string&)
+   *  \brief Starts a new section (checked by CheckpointReader::expect_section)
+   */
+  void section(const std::string& tag)
+  {
+    put<uint32_t>(tag.size());
+    out.write(tag.data(), tag.size());
+  }
+
+  template <class value_type>
+  void put(const value_type& value)
+  {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value_type));
+  }
+
+  template <class value_type>
+  void put_vector(const std::vector<value_type>& values)
+  {
+    put<uint64_t>(values.size());
+    out.write(reinterpret_cast<const char*>(values.data()), values.size()*sizeof(value_type));
+  }
+
+  /*! \fn void CheckpointWriter::put_array(const Eigen::PlainObjectBase<Derived>&)
+   *  \brief Writes shape and storage of an Eigen array (or of a derived matrix, e.g. MaskMatrix)
+   */
+  template <class Derived>
+  void put_array(const Eigen::PlainObjectBase<Derived>& array)
+  {
+    put<int32_t>(array.rows());
+    put<int32_t>(array.cols());
+    out.write(reinterpret_cast<const char*>(array.data()),
+      array.size()*sizeof(typename Derived::Scalar));
+  }
+
+  /*! \fn std::ostream& CheckpointWriter::stream(void)
+   *  \brief Raw access, for classes writing their own state (e.g. random engines)
+   */
+  inline std::ostream& stream(void) { return out; }
+
+  inline std::size_t get_size(void) const { return image.size(); }
+
+  /*! \fn void CheckpointWriter::write(const std::string&) const
+   *  \brief Writes the checkpoint to file, from the calling thread
+   */
+  void write(const std::string& file_name) const
+  {
+    write_file(image, file_name);
+  }
+
+  /*! \fn std::vector<char> CheckpointWriter::release(void)
+   *  \brief Hands the image over (e.g. to AsyncCheckpointWriter); the writer is left empty
+   */
+  std::vector<char> release(void)
+  {
+    return std::move(image);
+  }
+
+};
+
+/*! \class CheckpointReader
+ *  \brief Reads a whole checkpoint file; sections are read back in the order they were written
+ */
+class CheckpointReader
+{
+
+private:
+
+  std::istringstream buffer;
+
+public:
+
+  CheckpointReader(const std::string& file_name)
+  {
+    std::ifstream file(file_name, std::ios::binary);
+    if ( !file.is_open() )
+      throw "CheckpointReader: cannot open file";
+    std::ostringstream data;
+    data << file.rdbuf();
+    buffer.str(data.str());
+    char magic[sizeof(MAGIC)];
+    buffer.read(magic, sizeof(MAGIC));
+    if ( !buffer || std::string(magic, sizeof(MAGIC)) != std::string(MAGIC, sizeof(MAGIC)) )
+      throw "CheckpointReader: not a checkpoint file";
+    if ( get<uint32_t>() != BYTE_ORDER_MARK )
+      throw "CheckpointReader: checkpoint written with a different byte order";
+  }
+
+  /*! \fn void CheckpointReader::expect_section(const std::string&)
+   *  \brief Reads the tag of the next section, throws if it is not the given one
+   */
+  void expect_section(const std::string& tag)
+  {
+    std::string read_tag( get<uint32_t>(), '\0' );
+    buffer.read(&read_tag[0], read_tag.size());
+    if ( !buffer || read_tag != tag )
+    {
+      std::cerr << "[!] checkpoint: expected section '" << tag << "', found '" << read_tag << "'" << std::endl;
+      throw "CheckpointReader: unexpected section";
+    }
+  }
+
+  template <class value_type>
+  value_type get(void)
+  {
+    value_type value;
+    buffer.read(reinterpret_cast<char*>(&value), sizeof(value_type));
+    if ( !buffer )
+      throw "CheckpointReader: truncated file";
+    return value;
+  }
+
+  template <class value_type>
+  void get(value_type& value)
+  {
+    value = get<value_type>();
+  }
+
+  template <class value_type>
+  void get_vector(std::vector<value_type>& values)
+  {
+    values.resize( get<uint64_t>() );
+    buffer.read(reinterpret_cast<char*>(values.data()), values.size()*sizeof(value_type));
+    if ( !buffer )
+      throw "CheckpointReader: truncated file";
+  }
+
+  /*! \fn void CheckpointReader::get_array(Eigen::PlainObjectBase<Derived>&)
+   *  \brief Reads an array written by put_array, whose shape has to match the current one
+   */
+  template <class Derived>
+  void get_array(Eigen::PlainObjectBase<Derived>& array)
+  {
+    int32_t rows = get<int32_t>(), cols = get<int32_t>();
+    if ( rows != array.rows() || cols != array.cols() )
+      throw "CheckpointReader: array shape does not match the current grid";
+    buffer.read(reinterpret_cast<char*>(array.data()),
+      array.size()*sizeof(typename Derived::Scalar));
+    if ( !buffer )
+      throw "CheckpointReader: truncated file";
+  }
+
+  inline std::istream& stream(void) { return buffer; }
+
+};
+
+/*! \class AsyncCheckpointWriter
+ *  \brief Writes checkpoint images from a worker thread, recycling one staging buffer
+ *
+ *  The simulation stalls only while it waits for the previous image to be on disk
+ *  (acquire) and while it copies its state into the staging buffer; the stall of
+ *  each checkpoint is measured from acquire to submit
+ */
+class AsyncCheckpointWriter
+{
+
+public:
+  typedef std::chrono::steady_clock Clock;
+
+private:
+
+  const bool asynchronous;
+  std::vector<char> staging;        /*!< Image being written, or free buffer       */
+  std::string file_name;
+  bool pending = false;             /*!< An image waits to be written (or is)       */
+  bool stopping = false;
+  std::mutex mutex;
+  std::condition_variable job_ready, job_done;
+  std::thread worker;
+  Clock::time_point t_acquire;
+
+  // Statistics
+  int n_checkpoints = 0;
+  std::size_t last_bytes = 0;
+  double stall_time = 0.0;          /*!< Total time the simulation was stalled [s] */
+  double max_stall = 0.0;           /*!< Longest stall [s]                         */
+  double write_time = 0.0;          /*!< Time spent writing [s]                    */
+
+  static double seconds(Clock::time_point t0)
+  {
+    return std::chrono::duration<double>( Clock::now() - t0 ).count();
+  }
+
+  void write(void)
+  {
+    Clock::time_point t0 = Clock::now();
+    try
+    {
+      write_file(staging, file_name);
+    }
+    catch (const char* error)
+    {
+      std::cerr << "[!] " << error << " (" << file_name << ")" << std::endl;
+    }
+    write_time += seconds(t0);
+  }
+
+  /*! \fn void AsyncCheckpointWriter::run(void)
+   *  \brief Worker loop: writes each submitted image, until stopped
+   */
+  void run(void)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    while ( true )
+    {
+      job_ready.wait( lock, [this]{ return stopping || pending; } );
+      if ( !pending )
+        return;
+      // The simulation does not touch the staging buffer until pending is cleared
+      lock.unlock();
+      write();
+      lock.lock();
+      pending = false;
+      job_done.notify_all();
+    }
+  }
+
+public:
+
+  AsyncCheckpointWriter(bool asynchronous_ = CHECKPOINT_ASYNC): asynchronous(asynchronous_)
+  {
+    if ( asynchronous )
+      worker = std::thread(&AsyncCheckpointWriter::run, this);
+  }
+
+  ~AsyncCheckpointWriter()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    job_ready.notify_all();
+    if ( worker.joinable() )
+      worker.join();
+  }
+
+  AsyncCheckpointWriter(const AsyncCheckpointWriter&) = delete;
+  AsyncCheckpointWriter& operator=(const AsyncCheckpointWriter&) = delete;
+
+  /*! \fn std::vector<char> AsyncCheckpointWriter::acquire(void)
+   *  \brief Returns the staging buffer, once the previous image is on disk
+   */
+  std::vector<char> acquire(void)
+  {
+    t_acquire = Clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait( lock, [this]{ return !pending; } );
+    return std::move(staging);
+  }
+
+  /*! \fn double AsyncCheckpointWriter::submit(std::vector<char>&&, const std::string&)
+   *  \brief Hands an image over to the worker; returns the stall since acquire [s]
+   */
+  double submit(std::vector<char>&& image, const std::string& file_name_)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    staging = std::move(image);
+    file_name = file_name_;
+    last_bytes = staging.size();
+    n_checkpoints++;
+    if ( asynchronous )
+    {
+      pending = true;
+      job_ready.notify_one();
+    }
+    else
+      write();
+    double stall = seconds(t_acquire);
+    stall_time += stall;
+    max_stall = std::max( max_stall, stall );
+    return stall;
+  }
+
+  /*! \fn void AsyncCheckpointWriter::flush(void)
+   *  \brief Waits until the last image is on disk
+   */
+  void flush(void)
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    job_done.wait( lock, [this]{ return !pending; } );
+  }
+
+  // GETTERS (call after flush for consistent values)
+  inline bool is_asynchronous(void) const { return asynchronous; }
+  inline int get_n_checkpoints(void) const { return n_checkpoints; }
+  inline std::size_t get_last_bytes(void) const { return last_bytes; }
+  inline double get_stall_time(void) const { return stall_time; }
+  inline double get_max_stall(void) const { return max_stall; }
+  inline double get_write_time(void) const { return write_time; }
+
+};
+
+} /* namespace ev_checkpoint */
+
+#endif /* EV_CHECKPOINT_HPP */
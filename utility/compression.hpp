@@ -0,0 +1,185 @@
+/*! \file compression.hpp
+ *  \brief Header containing lossless transforms and a byte-oriented LZ codec
+ *
+ *  Sampled fields compress poorly as they are (the low-order bytes of doubles
+ *  look random), but well after two reversible transforms:
+ *    - XOR against the same field of the previous snapshot: bytes that did not
+ *      change (sign, exponent, leading mantissa) become zero;
+ *    - byte shuffling: byte k of all values is stored contiguously, giving long
+ *      runs of equal (mostly zero) bytes;
+ *  the LZ codec (LZ4-like sequences of literals and back-references) then
+ *  removes the redundancy, without external libraries
+ */
+
+#ifndef EV_COMPRESSION_HPP
+#define EV_COMPRESSION_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace ev_compress
+{
+
+/*! \enum CompressionStage
+ *  \brief Stages applied to the raw data (combined as a bit mask)
+ */
+enum CompressionStage
+{
+  NoCompression = 0,
+  ShuffleStage = 1,   /*!< Byte shuffling                         */
+  DeltaStage = 2,     /*!< XOR against the previous snapshot      */
+  LZStage = 4         /*!< LZ codec                               */
+};
+
+/*! \fn inline void shuffle(const char*, char*, std::size_t, std::size_t)
+ *  \brief Groups byte b of each value of the given width at out[b*n_values ...]
+ */
+inline void shuffle(const char* in, char* out, std::size_t n_bytes, std::size_t width)
+{
+  const std::size_t n_values = n_bytes / width;
+  for (std::size_t b = 0; b<width; ++b)
+    for (std::size_t k = 0; k<n_values; ++k)
+      out[b*n_values+k] = in[k*width+b];
+}
+
+/*! \fn inline void unshuffle(const char*, char*, std::size_t, std::size_t)
+ *  \brief Inverse of shuffle
+ */
+inline void unshuffle(const char* in, char* out, std::size_t n_bytes, std::size_t width)
+{
+  const std::size_t n_values = n_bytes / width;
+  for (std::size_t b = 0; b<width; ++b)
+    for (std::size_t k = 0; k<n_values; ++k)
+      out[k*width+b] = in[b*n_values+k];
+}
+
+/*! \fn inline void xor_delta(char*, const char*, std::size_t)
+ *  \brief XOR of data with a reference of the same size (its own inverse)
+ */
+inline void xor_delta(char* data, const char* reference, std::size_t n_bytes)
+{
+  std::size_t k = 0;
+  for (; k+8<=n_bytes; k += 8)
+  {
+    uint64_t a, b;
+    std::memcpy(&a, data+k, 8);
+    std::memcpy(&b, reference+k, 8);
+    a ^= b;
+    std::memcpy(data+k, &a, 8);
+  }
+  for (; k<n_bytes; ++k)
+    data[k] ^= reference[k];
+}
+
+// LZ codec: sequences of [token][literal length+][literals][offset (2 bytes)][match length+]
+// The token holds the literal length (high nibble) and match length-4 (low nibble), a nibble
+// equal to 15 is continued by bytes up to 255; the last sequence has literals only
+const int LZ_MIN_MATCH = 4;
+const int LZ_HASH_BITS = 16;
+const std::size_t LZ_MAX_OFFSET = 65535;
+
+inline void lz_put_length(std::vector<char>& out, std::size_t length)
+{
+  for (; length>=255; length -= 255)
+    out.push_back( (char)255 );
+  out.push_back( (char)length );
+}
+
+inline uint32_t lz_hash(const unsigned char* p)
+{
+  uint32_t v;
+  std::memcpy(&v, p, 4);
+  return ( v * 2654435761u ) >> ( 32-LZ_HASH_BITS );
+}
+
+/*! \fn inline std::vector<char> lz_compress(const char*, std::size_t)
+ *  \brief Greedy LZ compression (one hash-table candidate per position)
+ */
+inline std::vector<char> lz_compress(const char* data, std::size_t n)
+{
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+  std::vector<char> out;
+  out.reserve( n/2 + 16 );
+  std::vector<std::size_t> table( std::size_t(1) << LZ_HASH_BITS, n );
+  std::size_t anchor = 0, pos = 0;
+  while ( pos+LZ_MIN_MATCH <= n )
+  {
+    uint32_t h = lz_hash(in+pos);
+    std::size_t candidate = table[h];
+    table[h] = pos;
+    if ( candidate >= pos || pos-candidate > LZ_MAX_OFFSET || std::memcmp(in+candidate, in+pos, LZ_MIN_MATCH) != 0 )
+    {
+      pos++;
+      continue;
+    }
+    std::size_t length = LZ_MIN_MATCH;
+    while ( pos+length < n && in[candidate+length] == in[pos+length] )
+      length++;
+    // Sequence: literals [anchor, pos), then the match
+    std::size_t n_literals = pos - anchor;
+    std::size_t extra = length - LZ_MIN_MATCH;
+    out.push_back( (char)( ( std::min<std::size_t>(n_literals, 15) << 4 ) | std::min<std::size_t>(extra, 15) ) );
+    if ( n_literals >= 15 )
+      lz_put_length(out, n_literals-15);
+    out.insert( out.end(), data+anchor, data+pos );
+    std::size_t offset = pos - candidate;
+    out.push_back( (char)( offset & 0xFF ) );
+    out.push_back( (char)( offset >> 8 ) );
+    if ( extra >= 15 )
+      lz_put_length(out, extra-15);
+    pos += length;
+    anchor = pos;
+  }
+  std::size_t n_literals = n - anchor;
+  out.push_back( (char)( std::min<std::size_t>(n_literals, 15) << 4 ) );
+  if ( n_literals >= 15 )
+    lz_put_length(out, n_literals-15);
+  out.insert( out.end(), data+anchor, data+n );
+  return out;
+}
+
+/*! \fn inline void lz_decompress(const char*, std::size_t, char*, std::size_t)
+ *  \brief Decompresses exactly n_out bytes (throws on corrupted input)
+ */
+inline void lz_decompress(const char* data, std::size_t n_in, char* out, std::size_t n_out)
+{
+  const unsigned char* in = reinterpret_cast<const unsigned char*>(data);
+  std::size_t ip = 0, op = 0;
+  while ( ip < n_in )
+  {
+    unsigned token = in[ip++];
+    std::size_t n_literals = token >> 4;
+    if ( n_literals == 15 )
+      for (unsigned char b = 255; b==255 && ip<n_in; n_literals += b)
+        b = in[ip++];
+    if ( ip+n_literals > n_in || op+n_literals > n_out )
+      throw "lz_decompress: corrupted input";
+    std::memcpy(out+op, in+ip, n_literals);
+    ip += n_literals;
+    op += n_literals;
+    if ( ip == n_in )
+      break;
+    if ( ip+2 > n_in )
+      throw "lz_decompress: corrupted input";
+    std::size_t offset = in[ip] | ( in[ip+1] << 8 );
+    ip += 2;
+    std::size_t length = ( token & 15 );
+    if ( length == 15 )
+      for (unsigned char b = 255; b==255 && ip<n_in; length += b)
+        b = in[ip++];
+    length += LZ_MIN_MATCH;
+    if ( offset == 0 || offset > op || op+length > n_out )
+      throw "lz_decompress: corrupted input";
+    // Byte by byte: source and destination may overlap (runs)
+    for (std::size_t k = 0; k<length; ++k, ++op)
+      out[op] = out[op-offset];
+  }
+  if ( op != n_out )
+    throw "lz_decompress: corrupted input";
+}
+
+} /* namespace ev_compress */
+
+#endif /* EV_COMPRESSION_HPP */
@@ -0,0 +1,59 @@
+/*! \file parallel.hpp
+ *  \brief Header containing thin wrappers around the shared-memory threading runtime
+ *
+ *  The code is compiled with OpenMP when available (see PARALLEL in the Makefile);
+ *  the wrappers below allow the same sources to be built serially as well
+ */
+
+#ifndef EV_PARALLEL_HPP
+#define EV_PARALLEL_HPP
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*! \namespace ev_parallel
+ *  \brief A namespace containing utilities for thread-parallel kernels
+ */
+namespace ev_parallel
+{
+
+/*! \fn inline int max_threads(void)
+ *  \brief Number of threads available to a parallel region (1 in serial builds)
+ */
+inline int max_threads(void)
+{
+#ifdef _OPENMP
+  return omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+/*! \fn inline int thread_id(void)
+ *  \brief Index of the calling thread within a parallel region (0 in serial builds)
+ */
+inline int thread_id(void)
+{
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/*! \fn inline void set_threads(int n)
+ *  \brief Sets the number of threads for subsequent parallel regions (no-op in serial builds)
+ */
+inline void set_threads(int n)
+{
+#ifdef _OPENMP
+  omp_set_num_threads(n);
+#else
+  (void)n;
+#endif
+}
+
+} /* namespace ev_parallel */
+
+#endif /* EV_PARALLEL_HPP */
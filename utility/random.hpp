@@ -40,6 +40,19 @@ class RngAbstract
 {
 protected:
   int seed;
+  std::vector<real_number> scratch;   // Uniforms for batch samplers
+  template <class value_type>
+  static void write_state(std::ostream& out, const value_type& value)
+  {
+    out.write( reinterpret_cast<const char*>(&value), sizeof(value_type) );
+  }
+  template <class value_type>
+  static void read_state(std::istream& in, value_type& value)
+  {
+    in.read( reinterpret_cast<char*>(&value), sizeof(value_type) );
+    if ( !in )
+      throw "RNG state: truncated input";
+  }
 public:
   RngAbstract(int seed_ = DEFAULT_SEED):
     seed( seed_ ) { }
@@ -51,12 +64,39 @@ public:
   {
     seed = new_seed;
   }
+  /*! \fn virtual void save_state (std::ostream& out) const
+   *  \brief Writes the whole state of the engine (binary, host order)
+   *
+   *  After load_state, the engine continues the same sequence; derived classes
+   *  append their own state to the one of the base class
+   */
+  virtual void save_state (std::ostream& out) const
+  {
+    write_state(out, seed);
+  }
+  /*! \fn virtual void load_state (std::istream& in)
+   *  \brief Restores a state written by save_state (of the same engine)
+   */
+  virtual void load_state (std::istream& in)
+  {
+    read_state(in, seed);
+  }
   /*! \fn real_number sample_uniform (void)
    *  \brief algorithm for sampling a uniform between [0,1]
    *
    *  This is the samplig algorithm to be overridden by derived RNG classes
    */
   virtual real_number sample_uniform (void) = 0;
+  /*! \fn virtual void fill_uniform (real_number* u, std::size_t n)
+   *  \brief Fills u with n uniforms in [0,1)
+   *
+   *  Derived classes override it with a loop free of virtual calls
+   */
+  inline virtual void fill_uniform (real_number* u, std::size_t n)
+  {
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = sample_uniform();
+  }
   /*! \fn virtual void sample_unit_sphere (real_number& kx, real_number& ky, real_number& kz)
    *  \brief algorithm for sampling the vector k uniformly on a unit sphere
    */
@@ -68,10 +108,6 @@ public:
     phi = ev_const::pi2 * sample_uniform();
     kz = ky * sin(phi);
     ky = ky * cos(phi);
-    phi = sqrt(kx*kx + ky*ky + kz*kz);
-    kx = kx/phi;
-    ky = ky/phi;
-    kz = kz/phi;
   }
   /*! \fn virtual void sample_box_muller (real_number mass, real_number ux,
         real_number uy, real_number t, real_number& vx, real_number& vy, real_number& vz)
@@ -97,6 +133,87 @@ public:
     vy = uy + vy * sigma;
     vz = vz * sigma;
   }
+
+  // BATCH SAMPLERS
+  /*!
+   *  Uniforms are drawn at once through fill_uniform (one virtual call per batch),
+   *  then transformed in plain loops; both normals and unit vectors rely on pairs
+   *  uniform in the unit disc (Marsaglia's methods): 21% of the pairs are rejected,
+   *  but no trigonometric function is evaluated
+   */
+
+  /*! \fn void fill_normal (real_number* g, std::size_t n)
+   *  \brief Fills g with n standard normal variates (Marsaglia's polar method)
+   */
+  inline void fill_normal (real_number* g, std::size_t n)
+  {
+    std::size_t m = 0;
+    while ( m < n )
+    {
+      // Pairs fall in the unit disc with probability pi/4, each gives two variates
+      std::size_t na = (n-m)/2 + (n-m)/6 + 4;
+      scratch.resize(2*na);
+      fill_uniform(scratch.data(), 2*na);
+      for (std::size_t a = 0; a<na && m<n; ++a)
+      {
+        real_number x1 = 2.0 * scratch[2*a] - 1.0;
+        real_number x2 = 2.0 * scratch[2*a+1] - 1.0;
+        real_number s = x1*x1 + x2*x2;
+        if ( s < 1.0 && s > 0.0 )
+        {
+          real_number f = sqrt( -2.0 * log(s) / s );
+          g[m++] = x1 * f;
+          if ( m < n ) g[m++] = x2 * f;
+        }
+      }
+    }
+  }
+  /*! \fn void fill_maxwellian (real_number mass, real_number t, real_number ux, real_number uy,
+        real_number* vx, real_number* vy, real_number* vz, std::size_t n)
+   *  \brief Fills vx, vy, vz with n velocities from the Maxwellian (mass, t) drifting with (ux, uy, 0)
+   */
+  inline void fill_maxwellian (real_number mass, real_number t, real_number ux, real_number uy,
+    real_number* vx, real_number* vy, real_number* vz, std::size_t n)
+  {
+    real_number sigma = sqrt(t / mass);
+    fill_normal(vx, n);
+    fill_normal(vy, n);
+    fill_normal(vz, n);
+    for (std::size_t m = 0; m<n; ++m)
+    {
+      vx[m] = ux + sigma * vx[m];
+      vy[m] = uy + sigma * vy[m];
+      vz[m] = sigma * vz[m];
+    }
+  }
+  /*! \fn void fill_unit_sphere (real_number* kx, real_number* ky, real_number* kz, std::size_t n)
+   *  \brief Fills kx, ky, kz with n vectors uniform on the unit sphere (Marsaglia, 1972)
+   */
+  inline void fill_unit_sphere (real_number* kx, real_number* ky, real_number* kz, std::size_t n)
+  {
+    std::size_t m = 0;
+    while ( m < n )
+    {
+      // Pairs fall in the unit disc with probability pi/4
+      std::size_t na = (n-m) + (n-m)/3 + 4;
+      scratch.resize(2*na);
+      fill_uniform(scratch.data(), 2*na);
+      for (std::size_t a = 0; a<na && m<n; ++a)
+      {
+        real_number x1 = 2.0 * scratch[2*a] - 1.0;
+        real_number x2 = 2.0 * scratch[2*a+1] - 1.0;
+        real_number s = x1*x1 + x2*x2;
+        if ( s < 1.0 && s > 0.0 )
+        {
+          real_number r = 2.0 * sqrt(1.0 - s);
+          kx[m] = x1 * r;
+          ky[m] = x2 * r;
+          kz[m] = 1.0 - 2.0 * s;
+          m++;
+        }
+      }
+    }
+  }
   inline virtual ~RngAbstract() {}
 };
 
@@ -125,6 +242,15 @@ public:
   {
     return uniform_rv();
   }
+  // The engine drawing numbers is a copy held by uniform_rv: its state is not accessible
+  virtual void save_state(std::ostream&) const override
+  {
+    throw "StdRngObject: the state can not be saved";
+  }
+  virtual void load_state(std::istream&) override
+  {
+    throw "StdRngObject: the state can not be restored";
+  }
   inline virtual ~StdRngObject() {}
 };
 
@@ -139,7 +265,9 @@ enum RngType
   ParkMiller,
   Marsiglia,
   Splitmix,
-  Xorshift64
+  Xorshift64,
+  Philox,
+  Xoshiro256
 };
 
 /*! \class CustomRngObject
@@ -210,12 +338,32 @@ public:
       inext = 1;
     if (++inextp == 56)
       inextp = 1;
-    mj = ma[inext-1] - ma[inextp-1];
+    // ma[1..55] hold the state (ma[0] is unused, see ran3 in Numerical Recipes)
+    mj = ma[inext] - ma[inextp];
     if(mj < MZ)
       mj += MBIG;
     ma[inext] = mj;
     return mj * FAC;
   }
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = CustomRngObject<Knuth>::sample_uniform();
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, inext);
+    write_state(out, inextp);
+    write_state(out, ma);
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, inext);
+    read_state(in, inextp);
+    read_state(in, ma);
+  }
   virtual ~CustomRngObject<Knuth>() { }
 };
 
@@ -258,6 +406,11 @@ public:
     real_number ans = AM*seed;
     return ans;
   }
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = CustomRngObject<ParkMiller>::sample_uniform();
+  }
   virtual ~CustomRngObject<ParkMiller>() { }
 };
 
@@ -334,24 +487,195 @@ public:
       uni += 1.0;
     return uni;
   }
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = CustomRngObject<Marsiglia>::sample_uniform();
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, i97);
+    write_state(out, j97);
+    write_state(out, c);
+    write_state(out, cd);
+    write_state(out, cm);
+    for (int ii = 0; ii <= 97; ii++)
+      write_state(out, u[ii]);
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, i97);
+    read_state(in, j97);
+    read_state(in, c);
+    read_state(in, cd);
+    read_state(in, cm);
+    for (int ii = 0; ii <= 97; ii++)
+      read_state(in, u[ii]);
+  }
   virtual ~CustomRngObject<Marsiglia>() { }
 };
 
-/*
+/*! \class CustomRngObject<Philox>
+ *  \brief Implementation of the Philox4x32-10 counter-based random engine (Salmon et al., SC11)
+ *
+ *  Each output block is a bijective function of a 128-bit counter and a 64-bit
+ *  key: the key holds the seed and the stream id, the counter holds the block
+ *  index and the substream coordinates (step, cell). Any thread can then draw
+ *  the numbers of a given cell at a given step, independently of which thread
+ *  (or how many of them) did the previous work; each block yields four uniforms
+ *  with 32-bit resolution in [0,1)
+ */
+template<>
+class CustomRngObject<Philox> : public RngAbstract
+{
+private:
+  static constexpr uint32_t M0 = 0xD2511F53u;
+  static constexpr uint32_t M1 = 0xCD9E8D57u;
+  static constexpr uint32_t W0 = 0x9E3779B9u;
+  static constexpr uint32_t W1 = 0xBB67AE85u;
+  static constexpr real_number AM = 1.0 / 4294967296.0;
+  static constexpr int N_ROUNDS = 10;
+  uint32_t key[2];      // (seed, stream)
+  uint32_t ctr[4];      // (block low, block high, step, cell)
+  real_number buf[4];   // Current block (for sample_uniform)
+  int n_buf;            // Numbers left in the current block
+  void init(uint32_t stream_id)
+  {
+    key[0] = (uint32_t)seed;
+    key[1] = stream_id;
+    ctr[0] = ctr[1] = ctr[2] = ctr[3] = 0;
+    n_buf = 0;
+  }
+  // One block of the bijection, advancing the block counter
+  inline void next_block(uint32_t out[4])
+  {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r<N_ROUNDS; ++r)
+    {
+      uint64_t p0 = (uint64_t)M0 * c0;
+      uint64_t p1 = (uint64_t)M1 * c2;
+      c0 = (uint32_t)( p1 >> 32 ) ^ c1 ^ k0;
+      c1 = (uint32_t)p1;
+      c2 = (uint32_t)( p0 >> 32 ) ^ c3 ^ k1;
+      c3 = (uint32_t)p0;
+      k0 += W0;
+      k1 += W1;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+    if ( ++ctr[0] == 0 ) ++ctr[1];
+  }
+public:
+  CustomRngObject<Philox>(int seed_ = DEFAULT_SEED, uint32_t stream_id = 0):
+    RngAbstract(seed_) {
+      init(stream_id);
+    }
+  inline virtual void reseed(int new_seed = DEFAULT_SEED) override
+  {
+    seed = new_seed;
+    init(key[1]);
+  }
+  /*! \fn CustomRngObject<Philox> stream(uint32_t id) const
+   *  \brief Independent engine sharing the seed (e.g. one for each thread or module)
+   */
+  inline CustomRngObject<Philox> stream(uint32_t id) const
+  {
+    return CustomRngObject<Philox>(seed, id);
+  }
+  /*! \fn CustomRngObject<Philox> substream(uint32_t step, uint32_t cell) const
+   *  \brief Engine of the same stream drawing the numbers reserved to (step, cell)
+   */
+  inline CustomRngObject<Philox> substream(uint32_t step, uint32_t cell) const
+  {
+    CustomRngObject<Philox> sub(seed, key[1]);
+    sub.ctr[2] = step;
+    sub.ctr[3] = cell;
+    return sub;
+  }
+  /*! \fn void sample_uniform4(real_number* u)
+   *  \brief Draws a whole block of four uniforms
+   */
+  inline void sample_uniform4(real_number* u)
+  {
+    uint32_t x[4];
+    next_block(x);
+    for (int m = 0; m<4; ++m)
+      u[m] = AM * x[m];
+  }
+  /*! \fn void fill_uniform(real_number* u, std::size_t n)
+   *  \brief Fills u with n uniforms (same sequence as n calls to sample_uniform)
+   */
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    std::size_t m = 0;
+    for ( ; n_buf > 0 && m < n; ++m )
+      u[m] = buf[4 - (n_buf--)];
+    const std::size_t nb = m + (n - m) / 4 * 4;
+    for ( ; m < nb; m += 4 )
+      sample_uniform4(u + m);
+    for ( ; m < n; ++m )
+      u[m] = CustomRngObject<Philox>::sample_uniform();
+  }
+  inline virtual real_number sample_uniform(void) override
+  {
+    if ( n_buf == 0 )
+    {
+      sample_uniform4(buf);
+      n_buf = 4;
+    }
+    return buf[4 - (n_buf--)];
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, key);
+    write_state(out, ctr);
+    write_state(out, buf);
+    write_state(out, n_buf);
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, key);
+    read_state(in, ctr);
+    read_state(in, buf);
+    read_state(in, n_buf);
+  }
+  virtual ~CustomRngObject<Philox>() { }
+};
+
+/*! \fn inline uint64_t splitmix64(uint64_t& state)
+ *  \brief Advances a splitmix64 state and returns the next output (Steele et al., 2014)
+ */
+inline uint64_t splitmix64(uint64_t& state)
+{
+  uint64_t z = ( state += 0x9e3779b97f4a7c15ULL );
+  z = ( z ^ (z >> 30) ) * 0xbf58476d1ce4e5b9ULL;
+  z = ( z ^ (z >> 27) ) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/*! \fn inline real_number uniform53(uint64_t x)
+ *  \brief Maps the 53 upper bits of a 64-bit integer to a uniform in [0,1)
+ */
+inline real_number uniform53(uint64_t x)
+{
+  return (real_number)( x >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+/*! \class CustomRngObject<Splitmix>
+ *  \brief Implementation of splitmix64 random engine (period 2^64)
+ */
 template<>
 class CustomRngObject<Splitmix> : public RngAbstract
 {
 private:
-  static constexpr uint64_t C1 = 0x9e3779b97f4a7c15;
-  static constexpr uint64_t C2 = 0xbf58476d1ce4e5b9;
-  static constexpr uint64_t C3 = 0x94d049bb133111eb;
-  static constexpr uint64_t MX = 18446744073709551615;  // WARINING: INTEGER TOO LARGE TO BE REPRESENTED
   uint64_t state;
 public:
   CustomRngObject<Splitmix>(int seed_ = DEFAULT_SEED):
-    RngAbstract(seed_) {
-      state = (uint64_t)seed;
-    }
+    RngAbstract(seed_), state( (uint64_t)seed_ ) { }
   inline virtual void reseed(int new_seed = DEFAULT_SEED) override
   {
     seed = new_seed;
@@ -359,45 +683,219 @@ public:
   }
   inline virtual real_number sample_uniform(void) override
   {
-    uint64_t z = ( state += C1 );
-	  z = (z ^ (z >> 30)) * C2;
-	  z = (z ^ (z >> 27)) * C3;
-	  z = z ^ (z >> 31);
-    return ( (real_number)z / MX );
+    return uniform53( splitmix64(state) );
+  }
+  // The m-th output only depends on state + (m+1)*C1: the loop has no carried dependency
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    const uint64_t s0 = state;
+    for (std::size_t m = 0; m<n; ++m)
+    {
+      uint64_t z = s0 + (m+1) * 0x9e3779b97f4a7c15ULL;
+      z = ( z ^ (z >> 30) ) * 0xbf58476d1ce4e5b9ULL;
+      z = ( z ^ (z >> 27) ) * 0x94d049bb133111ebULL;
+      u[m] = uniform53( z ^ (z >> 31) );
+    }
+    state = s0 + n * 0x9e3779b97f4a7c15ULL;
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, state);
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, state);
   }
   virtual ~CustomRngObject<Splitmix>() { }
 };
-*/
 
-/*
+/*! \class CustomRngObject<Xorshift64>
+ *  \brief Implementation of Marsaglia's xorshift64 random engine (period 2^64-1)
+ */
 template<>
 class CustomRngObject<Xorshift64> : public RngAbstract
 {
 private:
-  static constexpr uint64_t MX = 18446744073709551615;  // WARNING: INTEGER TOO LARGE TO BE REPRESENTED
   uint64_t state;
+  void init(void)
+  {
+    // Seeding through splitmix64 never yields the forbidden zero state in practice
+    uint64_t sm = (uint64_t)seed;
+    state = splitmix64(sm);
+    if ( state == 0 ) state = 0x9e3779b97f4a7c15ULL;
+  }
 public:
   CustomRngObject<Xorshift64>(int seed_ = DEFAULT_SEED):
     RngAbstract(seed_) {
-      state = (uint64_t)seed;
+      init();
     }
   inline virtual void reseed(int new_seed = DEFAULT_SEED) override
   {
     seed = new_seed;
-    state = (uint64_t)seed;
+    init();
   }
   inline virtual real_number sample_uniform(void) override
   {
     uint64_t x = state;
-	  x ^= (x << 13);
-	  x ^= (x >> 7);
-	  x ^= (x << 17);
-	  state = x;
-    return ( (real_number)x / MX );
+    x ^= (x << 13);
+    x ^= (x >> 7);
+    x ^= (x << 17);
+    state = x;
+    return uniform53(x);
+  }
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = CustomRngObject<Xorshift64>::sample_uniform();
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, state);
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, state);
   }
   virtual ~CustomRngObject<Xorshift64>() { }
 };
+
+/*! \class CustomRngObject<Xoshiro256>
+ *  \brief Implementation of xoshiro256++ random engine (Blackman and Vigna, period 2^256-1)
+ *
+ *  Both single and bulk draws advance the main state, unless XOSHIRO_LANES > 1:
+ *  then bulk draws advance XOSHIRO_LANES further states, each 2^128 steps apart
+ *  from the previous one, interleaved component by component
+ */
+/*! \def XOSHIRO_LANES
+    \brief Number of interleaved states of the bulk draws (1 = plain loop on the main state)
+
+    Lanes are opt-in: GCC does not vectorize their update (not profitable, even
+    with -O3 -march=native on AVX-512) and they are slower than the plain loop
+    (see tests/bench_rng); they are kept for compilers or targets where they pay off
 */
+#ifndef XOSHIRO_LANES
+#define XOSHIRO_LANES 1
+#endif
+
+template<>
+class CustomRngObject<Xoshiro256> : public RngAbstract
+{
+private:
+  uint64_t s[4];          // Main state
+#if XOSHIRO_LANES > 1
+  static constexpr int NL = XOSHIRO_LANES;
+  uint64_t ls[4][NL];     // Lane states (component, lane)
+#endif
+  static inline uint64_t rotl(uint64_t x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+  static inline uint64_t next(uint64_t& s0, uint64_t& s1, uint64_t& s2, uint64_t& s3)
+  {
+    const uint64_t result = rotl(s0 + s3, 23) + s0;
+    const uint64_t t = s1 << 17;
+    s2 ^= s0;
+    s3 ^= s1;
+    s1 ^= s2;
+    s0 ^= s3;
+    s2 ^= t;
+    s3 = rotl(s3, 45);
+    return result;
+  }
+  // Equivalent to 2^128 calls to next
+  static void jump(uint64_t st[4])
+  {
+    static const uint64_t JUMP[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+      0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t j[4] = {0, 0, 0, 0};
+    for (int i = 0; i<4; ++i)
+      for (int b = 0; b<64; ++b)
+      {
+        if ( JUMP[i] & ( (uint64_t)1 << b ) )
+          for (int k = 0; k<4; ++k) j[k] ^= st[k];
+        next(st[0], st[1], st[2], st[3]);
+      }
+    for (int k = 0; k<4; ++k) st[k] = j[k];
+  }
+  void init(void)
+  {
+    uint64_t sm = (uint64_t)seed;
+    for (int k = 0; k<4; ++k)
+      s[k] = splitmix64(sm);
+#if XOSHIRO_LANES > 1
+    uint64_t st[4] = { s[0], s[1], s[2], s[3] };
+    for (int l = 0; l<NL; ++l)
+    {
+      jump(st);
+      for (int k = 0; k<4; ++k)
+        ls[k][l] = st[k];
+    }
+#endif
+  }
+public:
+  CustomRngObject<Xoshiro256>(int seed_ = DEFAULT_SEED):
+    RngAbstract(seed_) {
+      init();
+    }
+  inline virtual void reseed(int new_seed = DEFAULT_SEED) override
+  {
+    seed = new_seed;
+    init();
+  }
+  inline virtual real_number sample_uniform(void) override
+  {
+    return uniform53( next(s[0], s[1], s[2], s[3]) );
+  }
+  inline virtual void fill_uniform(real_number* u, std::size_t n) override
+  {
+#if XOSHIRO_LANES > 1
+    // Lanes are kept in local arrays: the output can not alias them
+    uint64_t s0[NL], s1[NL], s2[NL], s3[NL];
+    for (int l = 0; l<NL; ++l)
+    {
+      s0[l] = ls[0][l]; s1[l] = ls[1][l]; s2[l] = ls[2][l]; s3[l] = ls[3][l];
+    }
+    const std::size_t nb = n - n % NL;
+    std::size_t m = 0;
+    for ( ; m < nb; m += NL )
+      for (int l = 0; l<NL; ++l)
+        u[m+l] = uniform53( next(s0[l], s1[l], s2[l], s3[l]) );
+    for (int l = 0; l<NL; ++l)
+    {
+      ls[0][l] = s0[l]; ls[1][l] = s1[l]; ls[2][l] = s2[l]; ls[3][l] = s3[l];
+    }
+    for ( ; m < n; ++m )
+      u[m] = CustomRngObject<Xoshiro256>::sample_uniform();
+#else
+    // The state is kept in locals: the output can not alias it
+    uint64_t s0 = s[0], s1 = s[1], s2 = s[2], s3 = s[3];
+    for (std::size_t m = 0; m<n; ++m)
+      u[m] = uniform53( next(s0, s1, s2, s3) );
+    s[0] = s0; s[1] = s1; s[2] = s2; s[3] = s3;
+#endif
+  }
+  virtual void save_state(std::ostream& out) const override
+  {
+    RngAbstract::save_state(out);
+    write_state(out, s);
+#if XOSHIRO_LANES > 1
+    write_state(out, ls);
+#endif
+  }
+  virtual void load_state(std::istream& in) override
+  {
+    RngAbstract::load_state(in);
+    read_state(in, s);
+#if XOSHIRO_LANES > 1
+    read_state(in, ls);
+#endif
+  }
+  virtual ~CustomRngObject<Xoshiro256>() { }
+};
 
 } /* namespace ev_random */
 
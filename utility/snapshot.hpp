@@ -0,0 +1,458 @@
+/*! \file snapshot.hpp
+ *  \brief Header containing a binary container for the sampled fields of a step
+ *
+ *  A snapshot stores all fields of a step in one file, written with a single
+ *  buffered write. Layout (all integers and reals little-endian):
+ *
+ *    char[8]   magic "EVSNAP01"
+ *    uint32    number of fields
+ *    int32     nx, ny                  (cells of the grid)
+ *    float64   x_min, x_max, y_min, y_max
+ *    float64   time
+ *    int64     step
+ *    for each field:
+ *      uint32  length of the name, followed by the name (no terminator)
+ *      uint32  rows, cols
+ *    for each field:
+ *      float64 rows*cols values, row by row (as printed by Eigen)
+ *
+ *  Fields may have different shapes (e.g. grids, profiles, histograms)
+ *
+ *  Compressed snapshots (magic "EVSNAPZ1", see compression.hpp) have the same
+ *  header and directory, followed by:
+ *
+ *    uint32    stages applied (ev_compress::CompressionStage mask)
+ *    uint32    length of the reference file name, followed by the name
+ *              (previous snapshot, in the same directory; empty if no delta)
+ *    uint64    size of the raw data, size of the payload
+ *    payload   the raw data above, after XOR-delta, shuffle and LZ stages
+ */
+
+#ifndef EV_SNAPSHOT_HPP
+#define EV_SNAPSHOT_HPP
+
+#include <Eigen/Dense>
+
+#include "compression.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/*! \namespace ev_snapshot
+ *  \brief A namespace containing the binary snapshot writer and reader
+ */
+namespace ev_snapshot
+{
+
+typedef Eigen::Array<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> Field;
+
+const char MAGIC[8] = { 'E', 'V', 'S', 'N', 'A', 'P', '0', '1' };
+const char MAGIC_COMPRESSED[8] = { 'E', 'V', 'S', 'N', 'A', 'P', 'Z', '1' };
+
+/*! \fn inline bool host_is_little_endian(void)
+ *  \brief Whether the host stores integers little-endian (bytes are swapped otherwise)
+ */
+inline bool host_is_little_endian(void)
+{
+  const uint16_t one = 1;
+  unsigned char byte;
+  std::memcpy(&byte, &one, 1);
+  return byte == 1;
+}
+
+/*! \fn inline void to_little_endian(char*, std::size_t)
+ *  \brief Converts a value of the given size in place, between host and little-endian order
+ */
+inline void to_little_endian(char* bytes, std::size_t size)
+{
+  if ( host_is_little_endian() )
+    return;
+  for (std::size_t k = 0; k<size/2; ++k)
+    std::swap( bytes[k], bytes[size-1-k] );
+}
+
+/*! \struct Geometry
+ *  \brief Grid geometry, time and step of a snapshot
+ */
+struct Geometry
+{
+  int32_t nx = 0, ny = 0;
+  double x_min = 0.0, x_max = 0.0, y_min = 0.0, y_max = 0.0;
+  double time = 0.0;
+  int64_t step = 0;
+};
+
+template <class value_type>
+inline void put(std::vector<char>& buffer, value_type value)
+{
+  char bytes[sizeof(value_type)];
+  std::memcpy(bytes, &value, sizeof(value_type));
+  to_little_endian(bytes, sizeof(value_type));
+  buffer.insert(buffer.end(), bytes, bytes+sizeof(value_type));
+}
+
+/*! \fn inline void append_values(std::vector<char>&, const std::vector<Field>&)
+ *  \brief Appends the values of all fields, row by row, as little-endian float64
+ */
+inline void append_values(std::vector<char>& buffer, const std::vector<Field>& fields)
+{
+  std::size_t offset = buffer.size(), n_values = 0;
+  for (std::size_t f = 0; f<fields.size(); ++f)
+    n_values += fields[f].size();
+  buffer.resize( offset + n_values*sizeof(double) );
+  for (std::size_t f = 0; f<fields.size(); ++f)
+  {
+    std::size_t n_bytes = fields[f].size()*sizeof(double);
+    std::memcpy(buffer.data()+offset, fields[f].data(), n_bytes);
+    for (std::size_t k = 0; !host_is_little_endian() && k<n_bytes; k += sizeof(double))
+      to_little_endian(buffer.data()+offset+k, sizeof(double));
+    offset += n_bytes;
+  }
+}
+
+/*! \fn inline std::string directory_of(const std::string&)
+ *  \brief Directory part of a path, with trailing slash (empty if none)
+ */
+inline std::string directory_of(const std::string& file_name)
+{
+  std::size_t slash = file_name.rfind('/');
+  return slash == std::string::npos ? "" : file_name.substr(0, slash+1);
+}
+
+/*! \class SnapshotCompressor
+ *  \brief Compression stages for consecutive snapshots, with ratio and throughput statistics
+ *
+ *  The XOR-delta needs the previous snapshot: it is kept in memory, and its file
+ *  name is stored in the compressed file, so that the reader can undo the delta;
+ *  every `keyframe` snapshots (or when the fields change) no delta is applied,
+ *  which bounds the chain of files needed to read a snapshot. A snapshot becomes
+ *  the reference only once its file is written (see commit): after a failed write
+ *  the next delta still refers to the last file on disk
+ */
+class SnapshotCompressor
+{
+
+private:
+
+  const int stages;
+  const int keyframe;
+  int n_frames = 0;
+  std::string previous_file;          /*!< Reference for the next delta         */
+  std::string previous_layout;        /*!< Directory of the previous snapshot   */
+  std::vector<char> previous;         /*!< Raw data of the previous snapshot    */
+  std::string pending_file, pending_layout;   /*!< Encoded snapshot, not yet written  */
+  std::vector<char> pending;
+
+  // Statistics
+  uint64_t raw_bytes = 0, compressed_bytes = 0;
+  double seconds = 0.0;
+
+public:
+
+  SnapshotCompressor(int stages_, int keyframe_): stages(stages_), keyframe(keyframe_) { }
+  ~SnapshotCompressor() = default;
+
+  /*! \fn void SnapshotCompressor::encode(std::vector<char>&, const std::string&, std::vector<char>&, const std::string&)
+   *  \brief Appends stages, reference and payload of the raw data (which is recycled) to the buffer
+   *
+   *  The snapshot becomes the reference for the next delta only through commit
+   */
+  void encode(std::vector<char>& buffer, const std::string& layout, std::vector<char>& raw,
+    const std::string& file_name)
+  {
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    const uint64_t n_raw = raw.size();
+    bool delta = ( stages & ev_compress::DeltaStage ) && layout == previous_layout
+      && keyframe > 0 && n_frames % keyframe != 0;
+    std::vector<char> work(raw);
+    if ( delta )
+      ev_compress::xor_delta(work.data(), previous.data(), work.size());
+    if ( stages & ev_compress::ShuffleStage )
+    {
+      std::vector<char> shuffled( work.size() );
+      ev_compress::shuffle(work.data(), shuffled.data(), work.size(), sizeof(double));
+      work.swap(shuffled);
+    }
+    if ( stages & ev_compress::LZStage )
+      work = ev_compress::lz_compress(work.data(), work.size());
+    std::string reference = delta ? previous_file.substr( directory_of(previous_file).size() ) : "";
+    put<uint32_t>(buffer, delta ? stages : ( stages & ~ev_compress::DeltaStage ));
+    put<uint32_t>(buffer, reference.size());
+    buffer.insert(buffer.end(), reference.begin(), reference.end());
+    put<uint64_t>(buffer, n_raw);
+    put<uint64_t>(buffer, work.size());
+    buffer.insert(buffer.end(), work.begin(), work.end());
+    if ( stages & ev_compress::DeltaStage )
+    {
+      pending.swap(raw);
+      pending_layout = layout;
+      pending_file = file_name;
+    }
+    raw_bytes += n_raw;
+    compressed_bytes += work.size();
+    seconds += std::chrono::duration<double>( std::chrono::steady_clock::now() - t0 ).count();
+  }
+
+  /*! \fn void SnapshotCompressor::commit(void)
+   *  \brief Makes the last encoded snapshot the reference, once its file has been written
+   */
+  void commit(void)
+  {
+    if ( stages & ev_compress::DeltaStage )
+    {
+      previous.swap(pending);
+      previous_layout.swap(pending_layout);
+      previous_file.swap(pending_file);
+    }
+    n_frames++;
+  }
+
+  inline int get_stages(void) const { return stages; }
+  inline uint64_t get_raw_bytes(void) const { return raw_bytes; }
+  inline uint64_t get_compressed_bytes(void) const { return compressed_bytes; }
+  inline double get_seconds(void) const { return seconds; }
+  inline double get_ratio(void) const { return compressed_bytes > 0 ? (double)raw_bytes / compressed_bytes : 0.0; }
+
+};
+
+/*! \class SnapshotWriter
+ *  \brief Collects fields into a memory buffer, then writes them to a file at once
+ */
+class SnapshotWriter
+{
+
+private:
+
+  Geometry geometry;
+  std::vector<std::string> names;
+  std::vector<Field> fields;
+
+  /*! \fn std::vector<char> SnapshotWriter::directory(void) const
+   *  \brief Names and shapes of the fields, as stored in the header
+   */
+  std::vector<char> directory(void) const
+  {
+    std::vector<char> buffer;
+    for (std::size_t f = 0; f<fields.size(); ++f)
+    {
+      put<uint32_t>(buffer, names[f].size());
+      buffer.insert(buffer.end(), names[f].begin(), names[f].end());
+      put<uint32_t>(buffer, fields[f].rows());
+      put<uint32_t>(buffer, fields[f].cols());
+    }
+    return buffer;
+  }
+
+  /*! \fn std::vector<char> SnapshotWriter::header(const char*, const std::vector<char>&) const
+   *  \brief Magic, geometry, time, step and directory
+   */
+  std::vector<char> header(const char* magic, const std::vector<char>& dir) const
+  {
+    std::vector<char> buffer(magic, magic+8);
+    put<uint32_t>(buffer, fields.size());
+    put<int32_t>(buffer, geometry.nx);
+    put<int32_t>(buffer, geometry.ny);
+    put<double>(buffer, geometry.x_min);
+    put<double>(buffer, geometry.x_max);
+    put<double>(buffer, geometry.y_min);
+    put<double>(buffer, geometry.y_max);
+    put<double>(buffer, geometry.time);
+    put<int64_t>(buffer, geometry.step);
+    buffer.insert(buffer.end(), dir.begin(), dir.end());
+    return buffer;
+  }
+
+  static void write_buffer(const std::string& file_name, const std::vector<char>& buffer)
+  {
+    std::ofstream file(file_name, std::ios::binary);
+    if ( !file.is_open() )
+      throw "SnapshotWriter: cannot open output file";
+    file.write(buffer.data(), buffer.size());
+    file.close();
+    if ( !file )
+      throw "SnapshotWriter: write failed";
+  }
+
+public:
+
+  SnapshotWriter(const Geometry& geometry_): geometry(geometry_) { }
+  SnapshotWriter(SnapshotWriter&&) = default;
+  SnapshotWriter& operator=(SnapshotWriter&&) = default;
+  ~SnapshotWriter() = default;
+
+  /*! \fn void SnapshotWriter::add_field(const std::string&, const Eigen::DenseBase<Derived>&)
+   *  \brief Copies a field (any Eigen array or view) into the snapshot
+   */
+  template <class Derived>
+  void add_field(const std::string& name, const Eigen::DenseBase<Derived>& field)
+  {
+    names.push_back(name);
+    fields.push_back( field.derived().template cast<double>() );
+  }
+
+  inline const Geometry& get_geometry(void) const { return geometry; }
+  inline const std::vector<std::string>& get_names(void) const { return names; }
+  inline const std::vector<Field>& get_fields(void) const { return fields; }
+
+  /*! \fn void SnapshotWriter::write(const std::string&) const
+   *  \brief Serializes header and fields into one buffer and writes it with a single call
+   */
+  void write(const std::string& file_name) const
+  {
+    std::vector<char> buffer = header( MAGIC, directory() );
+    append_values(buffer, fields);
+    write_buffer(file_name, buffer);
+  }
+
+  /*! \fn void SnapshotWriter::write(const std::string&, SnapshotCompressor&) const
+   *  \brief As above, with the fields compressed (delta against the previous call)
+   */
+  void write(const std::string& file_name, SnapshotCompressor& compressor) const
+  {
+    std::vector<char> dir = directory();
+    std::vector<char> buffer = header(MAGIC_COMPRESSED, dir), raw;
+    append_values(raw, fields);
+    compressor.encode( buffer, std::string(dir.begin(), dir.end()), raw, file_name );
+    write_buffer(file_name, buffer);
+    compressor.commit();
+  }
+
+};
+
+/*! \class SnapshotReader
+ *  \brief Reads a whole snapshot file, giving access to its geometry and fields
+ */
+class SnapshotReader
+{
+
+private:
+
+  Geometry geometry;
+  std::vector<std::string> names;
+  std::vector<Field> fields;
+
+  template <class value_type>
+  static value_type get(std::ifstream& file)
+  {
+    char bytes[sizeof(value_type)];
+    file.read(bytes, sizeof(value_type));
+    if ( !file )
+      throw "SnapshotReader: truncated file";
+    to_little_endian(bytes, sizeof(value_type));
+    value_type value;
+    std::memcpy(&value, bytes, sizeof(value_type));
+    return value;
+  }
+
+  /*! \fn void SnapshotReader::decode(std::ifstream&, const std::string&, std::vector<char>&)
+   *  \brief Reads the payload of a compressed snapshot and undoes its stages
+   */
+  void decode(std::ifstream& file, const std::string& file_name, std::vector<char>& raw)
+  {
+    uint32_t stages = get<uint32_t>(file);
+    std::string reference( get<uint32_t>(file), ' ' );
+    file.read(&reference[0], reference.size());
+    uint64_t raw_size = get<uint64_t>(file);
+    std::vector<char> payload( get<uint64_t>(file) );
+    file.read(payload.data(), payload.size());
+    if ( !file || raw_size != raw.size() )
+      throw "SnapshotReader: truncated file";
+    if ( stages & ev_compress::LZStage )
+      ev_compress::lz_decompress(payload.data(), payload.size(), raw.data(), raw.size());
+    else if ( payload.size() == raw.size() )
+      raw.swap(payload);
+    else
+      throw "SnapshotReader: corrupted payload";
+    if ( stages & ev_compress::ShuffleStage )
+    {
+      std::vector<char> unshuffled( raw.size() );
+      ev_compress::unshuffle(raw.data(), unshuffled.data(), raw.size(), sizeof(double));
+      raw.swap(unshuffled);
+    }
+    if ( stages & ev_compress::DeltaStage )
+    {
+      SnapshotReader previous( directory_of(file_name) + reference );
+      std::vector<char> previous_raw;
+      append_values(previous_raw, previous.fields);
+      if ( previous_raw.size() != raw.size() )
+        throw "SnapshotReader: reference snapshot does not match";
+      ev_compress::xor_delta(raw.data(), previous_raw.data(), raw.size());
+    }
+  }
+
+public:
+
+  SnapshotReader(const std::string& file_name)
+  {
+    std::ifstream file(file_name, std::ios::binary);
+    if ( !file.is_open() )
+      throw "SnapshotReader: cannot open input file";
+    char magic[8];
+    file.read(magic, 8);
+    bool compressed = file && std::memcmp(magic, MAGIC_COMPRESSED, 8) == 0;
+    if ( !file || ( !compressed && std::memcmp(magic, MAGIC, 8) != 0 ) )
+      throw "SnapshotReader: not a snapshot file";
+    uint32_t n_fields = get<uint32_t>(file);
+    geometry.nx = get<int32_t>(file);
+    geometry.ny = get<int32_t>(file);
+    geometry.x_min = get<double>(file);
+    geometry.x_max = get<double>(file);
+    geometry.y_min = get<double>(file);
+    geometry.y_max = get<double>(file);
+    geometry.time = get<double>(file);
+    geometry.step = get<int64_t>(file);
+    std::size_t n_values = 0;
+    for (uint32_t f = 0; f<n_fields; ++f)
+    {
+      std::string name( get<uint32_t>(file), ' ' );
+      file.read(&name[0], name.size());
+      uint32_t rows = get<uint32_t>(file);
+      uint32_t cols = get<uint32_t>(file);
+      names.push_back(name);
+      fields.push_back( Field(rows, cols) );
+      n_values += fields[f].size();
+    }
+    std::vector<char> raw( n_values*sizeof(double) );
+    if ( compressed )
+      decode(file, file_name, raw);
+    else
+      file.read(raw.data(), raw.size());
+    if ( !file )
+      throw "SnapshotReader: truncated file";
+    std::size_t offset = 0;
+    for (uint32_t f = 0; f<n_fields; ++f)
+    {
+      std::size_t n_bytes = fields[f].size()*sizeof(double);
+      std::memcpy(fields[f].data(), raw.data()+offset, n_bytes);
+      for (Eigen::Index k = 0; !host_is_little_endian() && k<fields[f].size(); ++k)
+        to_little_endian( reinterpret_cast<char*>( fields[f].data()+k ), sizeof(double) );
+      offset += n_bytes;
+    }
+  }
+  ~SnapshotReader() = default;
+
+  inline const Geometry& get_geometry(void) const { return geometry; }
+  inline const std::vector<std::string>& get_names(void) const { return names; }
+  inline std::size_t get_n_fields(void) const { return fields.size(); }
+  inline const Field& get_field(std::size_t f) const { return fields[f]; }
+
+  /*! \fn const Field& SnapshotReader::get_field(const std::string&) const
+   *  \brief Field with the given name (throws if missing)
+   */
+  const Field& get_field(const std::string& name) const
+  {
+    for (std::size_t f = 0; f<names.size(); ++f)
+      if ( names[f] == name )
+        return fields[f];
+    throw "SnapshotReader: no field with this name";
+  }
+
+};
+
+} /* namespace ev_snapshot */
+
+#endif /* EV_SNAPSHOT_HPP */
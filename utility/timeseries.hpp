@@ -0,0 +1,369 @@
+/*! \file timeseries.hpp
+ *  \brief Header containing an append-only, memory-mapped store of snapshots
+ *
+ *  All snapshots of a run go into one file, which is mapped in memory by the
+ *  writer and (read-only) by any number of readers, also while the run goes on:
+ *
+ *    SeriesHeader                        (magic, counters, geometry, layout)
+ *    for each field: uint32 name length, name, uint32 rows, cols, uint64 offset
+ *    --- page boundary ---
+ *    SeriesEntry[capacity]               (step, time, offset of each record)
+ *    --- page boundary ---
+ *    records                             (all fields of a step, float64 row by row)
+ *
+ *  The file grows by chunks of records; a record is published by updating
+ *  n_records after its data and index entry have been written, so readers
+ *  always see complete records. Fields must keep their names and shapes for
+ *  the whole run. Data are stored in host order (little-endian hosts only)
+ */
+
+#ifndef EV_TIMESERIES_HPP
+#define EV_TIMESERIES_HPP
+
+#include "snapshot.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*! \def TIMESERIES_CAPACITY
+    \brief Maximum number of records (size of the preallocated index)
+*/
+#ifndef TIMESERIES_CAPACITY
+#define TIMESERIES_CAPACITY 10000
+#endif
+
+/*! \def TIMESERIES_CHUNK
+    \brief Number of records the file is extended by, each time it is full
+*/
+#ifndef TIMESERIES_CHUNK
+#define TIMESERIES_CHUNK 16
+#endif
+
+namespace ev_snapshot
+{
+
+const char SERIES_MAGIC[8] = { 'E', 'V', 'S', 'E', 'R', 'S', '0', '1' };
+
+/*! \struct SeriesHeader
+ *  \brief Fixed part of the header of a time-series store
+ */
+struct SeriesHeader
+{
+  char magic[8];
+  uint64_t n_records;       /*!< Published records (written last)       */
+  uint64_t capacity;        /*!< Entries of the index                   */
+  uint64_t index_offset;    /*!< Position of the index in the file      */
+  uint64_t data_offset;     /*!< Position of the first record           */
+  uint64_t record_bytes;    /*!< Size of a record                       */
+  int32_t nx, ny;
+  double x_min, x_max, y_min, y_max;
+  uint32_t n_fields;
+  uint32_t padding;
+};
+
+/*! \struct SeriesEntry
+ *  \brief Index entry of a record
+ */
+struct SeriesEntry
+{
+  int64_t step;
+  double time;
+  uint64_t offset;          /*!< Position of the record in the file     */
+};
+
+/*! \fn inline uint64_t round_to_page(uint64_t)
+ *  \brief Rounds a file offset up to a multiple of the page size
+ */
+inline uint64_t round_to_page(uint64_t offset)
+{
+  const uint64_t page = sysconf(_SC_PAGESIZE);
+  return ( (offset+page-1) / page ) * page;
+}
+
+/*! \class TimeSeriesWriter
+ *  \brief Appends snapshots to a memory-mapped store
+ */
+class TimeSeriesWriter
+{
+
+private:
+
+  int fd = -1;
+  char* map = nullptr;                  /*!< Mapping of the whole file          */
+  uint64_t map_bytes = 0;
+  uint64_t allocated = 0;               /*!< Records the file has room for      */
+  const uint64_t capacity, chunk;
+  std::vector<std::string> names;       /*!< Layout, fixed by the first record  */
+  std::vector<uint64_t> rows, cols;
+
+  inline SeriesHeader* header(void) { return reinterpret_cast<SeriesHeader*>(map); }
+
+  void remap(uint64_t bytes)
+  {
+    if ( ftruncate(fd, bytes) != 0 )
+      throw "TimeSeriesWriter: cannot extend file";
+    if ( map != nullptr )
+      munmap(map, map_bytes);
+    void* ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if ( ptr == MAP_FAILED )
+      throw "TimeSeriesWriter: cannot map file";
+    map = static_cast<char*>(ptr);
+    map_bytes = bytes;
+  }
+
+  /*! \fn void TimeSeriesWriter::create(const SnapshotWriter&)
+   *  \brief Writes header, directory and empty index, taking the layout from a snapshot
+   */
+  void create(const SnapshotWriter& snapshot)
+  {
+    std::vector<char> directory;
+    uint64_t record_bytes = 0;
+    for (std::size_t f = 0; f<snapshot.get_fields().size(); ++f)
+    {
+      const Field& field = snapshot.get_fields()[f];
+      names.push_back( snapshot.get_names()[f] );
+      rows.push_back( field.rows() );
+      cols.push_back( field.cols() );
+      uint32_t dir[3] = { (uint32_t)names[f].size(), (uint32_t)field.rows(), (uint32_t)field.cols() };
+      directory.insert( directory.end(), (char*)dir, (char*)(dir+1) );
+      directory.insert( directory.end(), names[f].begin(), names[f].end() );
+      directory.insert( directory.end(), (char*)(dir+1), (char*)(dir+3) );
+      directory.insert( directory.end(), (char*)&record_bytes, (char*)(&record_bytes+1) );
+      record_bytes += field.size()*sizeof(double);
+    }
+    uint64_t index_offset = round_to_page( sizeof(SeriesHeader) + directory.size() );
+    uint64_t data_offset = round_to_page( index_offset + capacity*sizeof(SeriesEntry) );
+    remap(data_offset);
+    SeriesHeader* h = header();
+    std::memcpy(h->magic, SERIES_MAGIC, 8);
+    h->n_records = 0;
+    h->capacity = capacity;
+    h->index_offset = index_offset;
+    h->data_offset = data_offset;
+    h->record_bytes = record_bytes;
+    h->nx = snapshot.get_geometry().nx;
+    h->ny = snapshot.get_geometry().ny;
+    h->x_min = snapshot.get_geometry().x_min;
+    h->x_max = snapshot.get_geometry().x_max;
+    h->y_min = snapshot.get_geometry().y_min;
+    h->y_max = snapshot.get_geometry().y_max;
+    h->n_fields = names.size();
+    h->padding = 0;
+    std::memcpy(map+sizeof(SeriesHeader), directory.data(), directory.size());
+  }
+
+public:
+
+  TimeSeriesWriter(const std::string& file_name, uint64_t capacity_ = TIMESERIES_CAPACITY,
+    uint64_t chunk_ = TIMESERIES_CHUNK): capacity(capacity_), chunk(chunk_)
+  {
+    if ( !host_is_little_endian() )
+      throw "TimeSeriesWriter: little-endian host required";
+    fd = open(file_name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if ( fd < 0 )
+      throw "TimeSeriesWriter: cannot open output file";
+  }
+
+  ~TimeSeriesWriter()
+  {
+    if ( map != nullptr )
+    {
+      msync(map, map_bytes, MS_SYNC);
+      munmap(map, map_bytes);
+    }
+    if ( fd >= 0 )
+      close(fd);
+  }
+
+  TimeSeriesWriter(const TimeSeriesWriter&) = delete;
+  TimeSeriesWriter& operator=(const TimeSeriesWriter&) = delete;
+
+  /*! \fn void TimeSeriesWriter::append(const SnapshotWriter&)
+   *  \brief Copies the fields of a snapshot into a new record, then publishes it
+   */
+  void append(const SnapshotWriter& snapshot)
+  {
+    if ( map == nullptr )
+      create(snapshot);
+    const std::vector<Field>& fields = snapshot.get_fields();
+    if ( fields.size() != names.size() )
+      throw "TimeSeriesWriter: snapshot layout differs from the store";
+    for (std::size_t f = 0; f<fields.size(); ++f)
+      if ( snapshot.get_names()[f] != names[f] || (uint64_t)fields[f].rows() != rows[f]
+        || (uint64_t)fields[f].cols() != cols[f] )
+        throw "TimeSeriesWriter: snapshot layout differs from the store";
+    uint64_t n = header()->n_records;
+    if ( n == capacity )
+      throw "TimeSeriesWriter: index full (increase TIMESERIES_CAPACITY)";
+    if ( n == allocated )
+    {
+      allocated = std::min( allocated+chunk, capacity );
+      remap( header()->data_offset + allocated*header()->record_bytes );
+    }
+    uint64_t offset = header()->data_offset + n*header()->record_bytes;
+    char* record = map + offset;
+    for (std::size_t f = 0; f<fields.size(); ++f)
+    {
+      std::memcpy(record, fields[f].data(), fields[f].size()*sizeof(double));
+      record += fields[f].size()*sizeof(double);
+    }
+    SeriesEntry* index = reinterpret_cast<SeriesEntry*>( map + header()->index_offset );
+    index[n].step = snapshot.get_geometry().step;
+    index[n].time = snapshot.get_geometry().time;
+    index[n].offset = offset;
+    // Publish: data and index entry become visible before the counter
+    __atomic_store_n( &header()->n_records, n+1, __ATOMIC_RELEASE );
+  }
+
+  inline uint64_t get_n_records(void) { return map == nullptr ? 0 : header()->n_records; }
+
+};
+
+/*! \class TimeSeriesReader
+ *  \brief Read-only mapping of a store (can be opened while the writer appends)
+ */
+class TimeSeriesReader
+{
+
+public:
+  typedef Eigen::Map<const Field> FieldView;
+
+private:
+
+  int fd = -1;
+  const char* map = nullptr;
+  uint64_t map_bytes = 0;
+  uint64_t n_records = 0;
+  Geometry geometry;
+  std::vector<std::string> names;
+  std::vector<uint32_t> rows, cols;
+  std::vector<uint64_t> offsets;        /*!< Position of each field within a record */
+
+  inline const SeriesHeader* header(void) const { return reinterpret_cast<const SeriesHeader*>(map); }
+
+public:
+
+  TimeSeriesReader(const std::string& file_name)
+  {
+    if ( !host_is_little_endian() )
+      throw "TimeSeriesReader: little-endian host required";
+    fd = open(file_name.c_str(), O_RDONLY);
+    if ( fd < 0 )
+      throw "TimeSeriesReader: cannot open input file";
+    refresh();
+    if ( map_bytes < sizeof(SeriesHeader) || std::memcmp(header()->magic, SERIES_MAGIC, 8) != 0 )
+      throw "TimeSeriesReader: not a time-series file";
+    geometry.nx = header()->nx;
+    geometry.ny = header()->ny;
+    geometry.x_min = header()->x_min;
+    geometry.x_max = header()->x_max;
+    geometry.y_min = header()->y_min;
+    geometry.y_max = header()->y_max;
+    const char* dir = map + sizeof(SeriesHeader);
+    for (uint32_t f = 0; f<header()->n_fields; ++f)
+    {
+      uint32_t len, shape[2];
+      uint64_t offset;
+      std::memcpy(&len, dir, 4);
+      names.push_back( std::string(dir+4, len) );
+      std::memcpy(shape, dir+4+len, 8);
+      std::memcpy(&offset, dir+12+len, 8);
+      rows.push_back(shape[0]);
+      cols.push_back(shape[1]);
+      offsets.push_back(offset);
+      dir += 20+len;
+    }
+  }
+
+  ~TimeSeriesReader()
+  {
+    if ( map != nullptr )
+      munmap(const_cast<char*>(map), map_bytes);
+    if ( fd >= 0 )
+      close(fd);
+  }
+
+  TimeSeriesReader(const TimeSeriesReader&) = delete;
+  TimeSeriesReader& operator=(const TimeSeriesReader&) = delete;
+
+  /*! \fn uint64_t TimeSeriesReader::refresh(void)
+   *  \brief Picks up the records appended since the last call (remaps if the file grew)
+   */
+  uint64_t refresh(void)
+  {
+    struct stat info;
+    if ( fstat(fd, &info) != 0 )
+      throw "TimeSeriesReader: cannot stat file";
+    if ( (uint64_t)info.st_size != map_bytes )
+    {
+      if ( map != nullptr )
+        munmap(const_cast<char*>(map), map_bytes);
+      map_bytes = info.st_size;
+      void* ptr = mmap(nullptr, map_bytes, PROT_READ, MAP_SHARED, fd, 0);
+      if ( ptr == MAP_FAILED )
+        throw "TimeSeriesReader: cannot map file";
+      map = static_cast<const char*>(ptr);
+    }
+    if ( map_bytes >= sizeof(SeriesHeader) )
+      n_records = __atomic_load_n( &header()->n_records, __ATOMIC_ACQUIRE );
+    // Records published after the last remap are not mapped yet
+    while ( n_records > 0 && header()->data_offset + n_records*header()->record_bytes > map_bytes )
+      n_records--;
+    return n_records;
+  }
+
+  inline const Geometry& get_geometry(void) const { return geometry; }
+  inline const std::vector<std::string>& get_names(void) const { return names; }
+  inline uint64_t get_n_records(void) const { return n_records; }
+  inline uint32_t get_rows(std::size_t f) const { return rows[f]; }
+  inline uint32_t get_cols(std::size_t f) const { return cols[f]; }
+
+  inline const SeriesEntry& get_entry(uint64_t k) const
+  {
+    return reinterpret_cast<const SeriesEntry*>( map + header()->index_offset )[k];
+  }
+
+  /*! \fn std::size_t TimeSeriesReader::find_field(const std::string&) const
+   *  \brief Position of the field with the given name (throws if missing)
+   */
+  std::size_t find_field(const std::string& name) const
+  {
+    for (std::size_t f = 0; f<names.size(); ++f)
+      if ( names[f] == name )
+        return f;
+    throw "TimeSeriesReader: no field with this name";
+  }
+
+  /*! \fn FieldView TimeSeriesReader::get_field(uint64_t, std::size_t) const
+   *  \brief Field of the k-th record, mapped without copies
+   */
+  inline FieldView get_field(uint64_t k, std::size_t f) const
+  {
+    const double* data = reinterpret_cast<const double*>( map + get_entry(k).offset + offsets[f] );
+    return FieldView(data, rows[f], cols[f]);
+  }
+
+  /*! \fn Field TimeSeriesReader::get_history(std::size_t) const
+   *  \brief A field across all records: row k holds the k-th record, flattened row by row
+   */
+  Field get_history(std::size_t f) const
+  {
+    Field history(n_records, rows[f]*cols[f]);
+    for (uint64_t k = 0; k<n_records; ++k)
+      history.row(k) = Eigen::Map<const Eigen::Array<double, 1, Eigen::Dynamic>>( get_field(k, f).data(), rows[f]*cols[f] );
+    return history;
+  }
+
+};
+
+} /* namespace ev_snapshot */
+
+#endif /* EV_TIMESERIES_HPP */
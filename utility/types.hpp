@@ -21,7 +21,7 @@
 #endif
 
 #ifndef RNG
-#define RNG ev_random::RngType::ParkMiller
+#define RNG ev_random::RngType::Xoshiro256
 #endif
 
 #ifndef CORR
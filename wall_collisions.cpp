@@ -1 +1,351 @@
+/*! \file wall_collisions.cpp
+ *  \brief Source code for the class implementing gas-wall collisions simulation
+ */
+
 #include "wall_collisions.hpp"
+#include "configuration.hpp"
+#include "boundary.hpp"
+#include "grid.hpp"
+#include "particles.hpp"
+#include "density.hpp"
+#include "times.hpp"
+
+#include "checkpoint.hpp"
+
+WallCollisionHandler::WallCollisionHandler(DSMC* dsmc):
+  Motherbase(dsmc),
+  a12( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
+  vrmax12( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
+  vrmaxnew12( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
+  freq12( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0.0 ),
+  n_coll_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  cand_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  real_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  over_cell( 0, grid->get_n_cells_x(), 0, grid->get_n_cells_y(), 0 ),
+  band_cells(),
+  band_walls(),
+  band_axis(),
+  band_sign(),
+  band_cap(),
+  batch(),
+  gw_x(),
+  gw_y(),
+  gw_z(),
+  n_wall( 6.0 * conf->get_eta_w1() / ( ev_const::pi * ev_utility::power<3>(species->get_diam_solid()) ) ),
+  chi_wall( CorrelationFun()( conf->get_eta_w1() ) ),
+  sigma_gw( species->get_diam_gw() ),
+  mass_ratio( 2.0 * species->get_mass_solid() / ( species->get_mass_fluid() + species->get_mass_solid() ) ),
+  mass_solid( species->get_mass_solid() ),
+  T_w( conf->get_T_w() ),
+  U_wx( conf->get_U_wx() ),
+  U_wy( conf->get_U_wy() ),
+  nx( grid->get_n_cells_x() ),
+  ny( grid->get_n_cells_y() ),
+  xmin( grid->get_x_min() ),
+  ymin( grid->get_y_min() ),
+  rdx( grid->get_rdx() ),
+  rdy( grid->get_rdy() ),
+  delta_t( times->get_delta_t() )
+  {
+    std::cout << "### SETTING-UP GAS-WALL COLLISION STAGE ###" << std::endl;
+    // Edges: 0 = x1, 1 = y1, 2 = x2, 3 = y2 (see Boundary)
+    x_wall = { -boundary->get_Lx1(), -boundary->get_Ly1(), boundary->get_Lx2(), boundary->get_Ly2() };
+    for (int k = 0; k<4; ++k)
+    {
+      is_wall[k] = ( boundary->get_wall_condition()[k] == 'w' );
+      vth_w[k] = sqrt( T_w[k] / mass_solid );
+    }
+    setup_band();
+    a12.fill(0.0);
+    for (auto it = band_cells.cbegin(); it!=band_cells.cend(); ++it)
+      a12( *it % nx, *it / nx ) = n_wall * chi_wall;
+    std::cout << " >> band cells = " << band_cells.size() << ";\tn_w = " << n_wall
+      << ";\tchi_w = " << chi_wall << std::endl;
+  }
+
+void
+WallCollisionHandler::setup_band
+(void)
+{
+  real_number dx = grid->get_dx(), dy = grid->get_dy();
+  real_number x0, x1, y0, y1;
+  int mask;
+  band_cells.clear();
+  band_walls.clear();
+  band_axis.clear();
+  band_sign.clear();
+  band_cap.clear();
+  for (int j = 0; j<ny; ++j)
+  {
+    y0 = ymin + j*dy;
+    y1 = y0 + dy;
+    for (int i = 0; i<nx; ++i)
+    {
+      x0 = xmin + i*dx;
+      x1 = x0 + dx;
+      mask = 0;
+      // Cell overlapping the layer [wall, wall + diam_gw] on the gas side
+      if ( is_wall[0] && x0 < x_wall[0] + sigma_gw && x1 > x_wall[0] ) mask |= 1;
+      if ( is_wall[1] && y0 < x_wall[1] + sigma_gw && y1 > x_wall[1] ) mask |= 2;
+      if ( is_wall[2] && x1 > x_wall[2] - sigma_gw && x0 < x_wall[2] ) mask |= 4;
+      if ( is_wall[3] && y1 > x_wall[3] - sigma_gw && y0 < x_wall[3] ) mask |= 8;
+      if ( mask != 0 )
+      {
+        band_cells.push_back( grid->lexico(i,j) );
+        band_walls.push_back( mask );
+        // Cap of k-vectors reaching the wall (whole sphere for corner cells)
+        switch ( mask )
+        {
+          case 1: band_axis.push_back(0); band_sign.push_back( 1.0); band_cap.push_back( (x0-x_wall[0])/sigma_gw ); break;
+          case 2: band_axis.push_back(1); band_sign.push_back( 1.0); band_cap.push_back( (y0-x_wall[1])/sigma_gw ); break;
+          case 4: band_axis.push_back(0); band_sign.push_back(-1.0); band_cap.push_back( (x_wall[2]-x1)/sigma_gw ); break;
+          case 8: band_axis.push_back(1); band_sign.push_back(-1.0); band_cap.push_back( (x_wall[3]-y1)/sigma_gw ); break;
+          default: band_axis.push_back(0); band_sign.push_back(1.0); band_cap.push_back(-1.0); continue;
+        }
+        band_cap.back() = std::max( -1.0, std::min( 1.0, band_cap.back() ) );
+      }
+    }
+  }
+}
+
+void
+WallCollisionHandler::compute_majorants
+(void)
+{
+  int i, j, np, idx_p1, iw;
+  real_number vwx, vwy, vwz, vr;
+  vrmax12.fill(0.0);
+  vrmaxnew12.fill(0.0);
+  for (std::size_t b = 0; b<band_cells.size(); ++b)
+  {
+    j = band_cells[b] / nx;
+    i = band_cells[b] - j*nx;
+    np = density->get_npc(i,j);
+    // Wall facing the cell (the first one, for corner cells)
+    iw = 0;
+    while ( !( band_walls[b] & (1<<iw) ) ) iw++;
+    for (int itest = 0; itest<TEST_COEFF_MULT*np; ++itest)
+    {
+      idx_p1 = density->ind( density->iof(band_cells[b]) + (int)( rng->sample_uniform() * np ) );
+      rng->sample_box_muller( mass_solid, U_wx[iw], U_wy[iw], T_w[iw], vwx, vwy, vwz );
+      vr = sqrt (
+          ev_utility::power<2>( vwx - ensemble->get_vx(idx_p1) )
+        + ev_utility::power<2>( vwy - ensemble->get_vy(idx_p1) )
+        + ev_utility::power<2>( vwz - ensemble->get_vz(idx_p1) )
+      );
+      vrmax12(i,j) = std::max( vrmax12(i,j), vr );
+    }
+    vrmaxnew12(i,j) = vrmax12(i,j);
+  }
+}
+
+void
+WallCollisionHandler::compute_collision_number
+(void)
+{
+  int i, j;
+  real_number cnc;
+  for (std::size_t b = 0; b<band_cells.size(); ++b)
+  {
+    j = band_cells[b] / nx;
+    i = band_cells[b] - j*nx;
+    // Each gas particle is a candidate (4*pi times the fraction of sphere spanned by k)
+    freq12(i,j) = 2.0*ev_const::pi2*sigma_gw*sigma_gw*a12(i,j)*vrmax12(i,j)*delta_t*density->get_npc(i,j)
+      * 0.5*( 1.0 - band_cap[b] );
+    cnc = freq12(i,j);
+    n_coll_cell(i,j) = (int)cnc;
+    if ( rng->sample_uniform() < cnc - n_coll_cell(i,j) ) n_coll_cell(i,j)++;
+  }
+}
+
+void
+WallCollisionHandler::collide_cell
+(int b)
+{
+  int idx_cell1 = band_cells[b];
+  int j_cell1 = idx_cell1 / nx;
+  int i_cell1 = idx_cell1 - j_cell1 * nx;
+  int n_cand = n_coll_cell(i_cell1, j_cell1);
+  int npc1 = density->get_npc(i_cell1, j_cell1);
+  if ( n_cand == 0 || npc1 == 0 )
+    return;
+  batch.reserve(n_cand);
+  const int iof1 = density->iof(idx_cell1);
+  const int mask = band_walls[b];
+  const real_number cap = band_cap[b], sign = band_sign[b];
+  real_number* kn = ( band_axis[b] == 0 ) ? batch.kx.data() : batch.ky.data();
+  real_number* kt = ( band_axis[b] == 0 ) ? batch.ky.data() : batch.kx.data();
+  // Block layout as in CollisionHandler::collide_cell (partner block unused)
+  real_number* u_p1 = batch.rnd.data();
+  real_number* u_cos = u_p1 + n_cand;
+  real_number* u_phi = u_cos + n_cand;
+  real_number* u_acc = u_phi + 2*n_cand;
+  rng->RandomEngine::fill_uniform(batch.rnd.data(), 5*n_cand);
+  if ( (int)gw_x.size() < n_cand )
+  {
+    gw_x.resize(n_cand); gw_y.resize(n_cand); gw_z.resize(n_cand);
+  }
+  rng->fill_normal(gw_x.data(), n_cand);
+  rng->fill_normal(gw_y.data(), n_cand);
+  rng->fill_normal(gw_z.data(), n_cand);
+  // Unit k-vectors (normal component uniform within the cap) and first particles
+  for (int m = 0; m < n_cand; ++m)
+  {
+    real_number c = cap + ( 1.0 - cap ) * u_cos[m];
+    real_number s = sqrt( 1.0 - c*c );
+    real_number phi = ev_const::pi2 * u_phi[m];
+    kn[m] = sign * c;
+    kt[m] = s * cos(phi);
+    batch.kz[m] = s * sin(phi);
+    batch.p1[m] = density->ind( iof1 + (int)( u_p1[m] * npc1 ) );
+  }
+  real_number& vrmax1 = vrmax12(i_cell1, j_cell1);
+  real_number& vrmaxnew1 = vrmaxnew12(i_cell1, j_cell1);
+  int n_cand1 = 0, n_real1 = 0, n_over1 = 0;
+  for (int m = 0; m < n_cand; ++m)
+  {
+    int idx_p1 = batch.p1[m];
+    real_number kx = batch.kx[m], ky = batch.ky[m], kz = batch.kz[m];
+    // The partner lies at x1 - sigma_gw*k: it has to be inside a wall
+    int iw = find_wall( mask, ensemble->get_xp(idx_p1) - sigma_gw*kx, ensemble->get_yp(idx_p1) - sigma_gw*ky );
+    if ( iw < 0 )
+    {
+      n_fake++;
+      n_total++;
+      continue;
+    }
+    // Velocity of the wall partner from the Maxwellian of wall iw
+    real_number gx = U_wx[iw] + vth_w[iw]*gw_x[m] - ensemble->get_vx(idx_p1);
+    real_number gy = U_wy[iw] + vth_w[iw]*gw_y[m] - ensemble->get_vy(idx_p1);
+    real_number gz = vth_w[iw]*gw_z[m] - ensemble->get_vz(idx_p1);
+    real_number vr = sqrt( gx*gx + gy*gy + gz*gz );
+    vrmaxnew1 = std::max( vrmaxnew1, vr );
+    real_number scalar_prod = gx*kx + gy*ky + gz*kz;
+    if ( scalar_prod > 0.0 )
+    {
+      real_number fk = scalar_prod / vrmax1;
+      if (fk > 1.0)
+      {
+        n_fake_idx++;
+        n_over1++;
+      }
+      n_cand1++;
+      if ( u_acc[m] < fk )
+      {
+        n_real++;
+        n_real1++;
+        scalar_prod *= mass_ratio;
+        ensemble->get_vx(idx_p1) += kx*scalar_prod;
+        ensemble->get_vy(idx_p1) += ky*scalar_prod;
+        ensemble->get_vz(idx_p1) += kz*scalar_prod;
+      }
+      else
+      {
+        n_fake++;
+      }
+    }
+    else
+    {
+      n_fake++;
+    }
+    n_total++;
+  }
+  cand_cell(i_cell1, j_cell1) += n_cand1;
+  real_cell(i_cell1, j_cell1) += n_real1;
+  over_cell(i_cell1, j_cell1) += n_over1;
+}
+
+void
+WallCollisionHandler::perform_collisions
+(void)
+{
+  compute_collision_number();
+  n_fake_idx = 0; n_fake = 0; n_real = 0; n_total = 0;
+  for (std::size_t b = 0; b<band_cells.size(); ++b)
+    collide_cell(b);
+  std::cout << "gas-wall collisions performed" << std::endl;
+  std::cout << "total = " << n_total << "\t real = " << n_real << "\t fake = " << n_fake << "\t out-range = " << n_fake_idx << std::endl;
+  update_majorants();
+}
+
+void
+WallCollisionHandler::update_majorants
+(void)
+{
+  int i, j;
+  for (auto it = band_cells.cbegin(); it!=band_cells.cend(); ++it)
+  {
+    j = *it / nx;
+    i = *it - j*nx;
+    if ( !PER_CELL_MAJORANTS )
+    {
+      if ( (double)n_fake_idx > alpha_1*(double)n_real || vrmax12(i,j) == 0.0 )
+        vrmax12(i,j) = vrmaxnew12(i,j);
+      else
+        vrmax12(i,j) *= alpha_2;
+      continue;
+    }
+    // (1) Majorant never estimated or exceeded: restore running maximum
+    if ( vrmax12(i,j) == 0.0 )
+    {
+      vrmax12(i,j) = vrmaxnew12(i,j);
+      continue;
+    }
+    else if ( over_cell(i,j) > 0 && (double)over_cell(i,j) > alpha_1*(double)real_cell(i,j) )
+      vrmax12(i,j) = vrmaxnew12(i,j);
+    // (2) Window not yet complete: wait
+    else if ( cand_cell(i,j) < min_candidates )
+      continue;
+    // (3) Too many fake collisions: lower majorant
+    else if ( (double)real_cell(i,j) < target_acceptance*(double)cand_cell(i,j) )
+      vrmax12(i,j) *= alpha_2;
+    cand_cell(i,j) = 0;
+    real_cell(i,j) = 0;
+    over_cell(i,j) = 0;
+  }
+}
+
+void
+WallCollisionHandler::perform_collision_kernel
+(void)
+{
+  if ( band_cells.empty() )
+    return;
+  perform_collisions();
+}
+
+void
+WallCollisionHandler::save_checkpoint
+(ev_checkpoint::CheckpointWriter& checkpoint) const
+{
+  checkpoint.section("wall_collisions");
+  checkpoint.put<int32_t>(n_fake);
+  checkpoint.put<int32_t>(n_real);
+  checkpoint.put<int32_t>(n_total);
+  checkpoint.put<int32_t>(n_fake_idx);
+  checkpoint.put_array(a12);
+  checkpoint.put_array(vrmax12);
+  checkpoint.put_array(vrmaxnew12);
+  checkpoint.put_array(freq12);
+  checkpoint.put_array(cand_cell);
+  checkpoint.put_array(real_cell);
+  checkpoint.put_array(over_cell);
+}
+
+void
+WallCollisionHandler::load_checkpoint
+(ev_checkpoint::CheckpointReader& checkpoint)
+{
+  checkpoint.expect_section("wall_collisions");
+  checkpoint.get(n_fake);
+  checkpoint.get(n_real);
+  checkpoint.get(n_total);
+  checkpoint.get(n_fake_idx);
+  checkpoint.get_array(a12);
+  checkpoint.get_array(vrmax12);
+  checkpoint.get_array(vrmaxnew12);
+  checkpoint.get_array(freq12);
+  checkpoint.get_array(cand_cell);
+  checkpoint.get_array(real_cell);
+  checkpoint.get_array(over_cell);
+}
@@ -1,13 +1,156 @@
+/*! \file wall_collisions.hpp
+ *  \brief Header containing class for gas-wall collisions simulation
+ *
+ *  Solid walls ('w' b.c.) are modelled as half-spaces filled with wall particles
+ *  of number density n_w = 6*eta_w1/(pi*sigma_w^3), kept at the wall temperature;
+ *  gas particles closer than diam_gw to a wall undergo Enskog collisions with
+ *  virtual wall particles whose velocity is sampled from the wall Maxwellian
+ */
+
 #ifndef WALL_COLLISIONS_HPP
 #define WALL_COLLISIONS_HPP
 
-/*
+#include "motherbase.hpp"
+#include "matrix.hpp"
+#include "collisions.hpp"
+
+#include <array>
+#include <vector>
+
+/*! \class WallCollisionHandler
+ *  \brief Class for gas-wall collisions simulation
+ *
+ *  Only the band of cells within diam_gw of a solid wall is visited, hence bulk
+ *  cells (and domains without walls) pay nothing; candidates are drawn with the
+ *  same majorant scheme as gas-gas collisions, with their own majorants a12, vrmax12
+ *
+ *  For a particle at distance d from a wall the partner lies inside the wall only
+ *  if the normal component of k exceeds d/diam_gw: in cells facing a single wall,
+ *  k is drawn from the spherical cap above the cell's minimum distance and the
+ *  number of candidates is scaled by the cap area, so that fewer candidates miss
+ */
+class WallCollisionHandler : protected Motherbase
+{
+
+private:
+
+  // Global number of collisions
+  int n_fake = 0;       /*!< Number of false collisions                 */
+  int n_real = 0;       /*!< Number of true collisions                  */
+  int n_total = 0;      /*!< Total number  collisions                   */
+  int n_fake_idx = 0;   /*!< True collisions for which probability > 1  */
+
+  // Collisional majorants
+  ev_matrix::MaskMatrix<real_number> a12;         /*!< Majorant A_i (wall density * correlation) */
+  ev_matrix::MaskMatrix<real_number> vrmax12;     /*!< Majorant C_i (relative speed)             */
+  ev_matrix::MaskMatrix<real_number> vrmaxnew12;  /*!< Updated values for C_i                    */
+  ev_matrix::MaskMatrix<real_number> freq12;      /*!< Expected no. of candidates for each cell  */
+  ev_matrix::MaskMatrix<int> n_coll_cell;         /*!< Number of candidates for each cell        */
+
+  // Collision statistics of the current control window, for each cell
+  ev_matrix::MaskMatrix<int> cand_cell;     /*!< Candidates with the partner inside a wall */
+  ev_matrix::MaskMatrix<int> real_cell;     /*!< Real collisions                           */
+  ev_matrix::MaskMatrix<int> over_cell;     /*!< Collisions with probability > 1           */
+
+  // Band of cells facing solid walls
+  std::vector<int> band_cells;    /*!< Lexico index of cells within diam_gw of a wall       */
+  std::vector<int> band_walls;    /*!< Walls faced by each band cell (bit k = edge k)       */
+  std::vector<int> band_axis;     /*!< Normal direction of the faced wall (0 = x, 1 = y)    */
+  std::vector<real_number> band_sign;   /*!< Orientation of k towards the faced wall        */
+  std::vector<real_number> band_cap;    /*!< Lower bound of the normal component of k       */
+  std::array<bool, 4> is_wall;    /*!< Edges with solid wall b.c.                           */
+  std::array<real_number, 4> x_wall;  /*!< Position of the wall planes (x1, y1, x2, y2)     */
+
+  CandidateBatch batch;           /*!< Candidates scratch (see CollisionHandler)            */
+  std::vector<real_number> gw_x, gw_y, gw_z;  /*!< Standard normals for wall velocities (one per candidate) */
+
+  // Wall properties
+  const real_number n_wall;       /*!< Number density of wall particles           */
+  const real_number chi_wall;     /*!< Gas-wall correlation (at eta_w1)           */
+  const real_number sigma_gw;     /*!< Gas-wall cross section                     */
+  const real_number mass_ratio;   /*!< 2*m_w/(m_g+m_w)                            */
+  const real_number mass_solid;   /*!< Mass of wall particles                     */
+  const std::array<real_number, 4> T_w, U_wx, U_wy;
+  std::array<real_number, 4> vth_w;   /*!< Thermal speed sqrt(T_w/m_w) of each wall     */
+
+  // Controlling number of collisions
+  const real_number alpha_1 = DEFAULT_ALPHA_1;  /*!< First coefficient for collision number control   */
+  const real_number alpha_2 = DEFAULT_ALPHA_2;  /*!< Second coefficient for collision number control  */
+  const real_number target_acceptance = DEFAULT_TARGET_ACCEPTANCE;  /*!< Target real/candidate ratio  */
+  const int min_candidates = DEFAULT_MIN_CANDIDATES;                /*!< Minimum window for a cell    */
+
+  // References from other classes
+  const int& nx, ny;
+  const real_number& xmin, ymin;
+  const real_number& rdx, rdy;
+  const real_number& delta_t;
+
+  /*! \fn void WallCollisionHandler::setup_band(void)
+      \brief Lists the cells overlapping the layer of width diam_gw in front of each wall
+  */
+  void setup_band(void);
+
+  /*! \fn int WallCollisionHandler::find_wall(int, real_number, real_number) const
+      \brief Returns the wall containing the point (x,y) among the ones in the mask (-1 if none)
+  */
+  inline int find_wall(int mask, real_number x, real_number y) const
+  {
+    if ( (mask & 1) && x < x_wall[0] ) return 0;
+    if ( (mask & 2) && y < x_wall[1] ) return 1;
+    if ( (mask & 4) && x > x_wall[2] ) return 2;
+    if ( (mask & 8) && y > x_wall[3] ) return 3;
+    return -1;
+  }
+
+  /*! \fn void WallCollisionHandler::collide_cell(int)
+      \brief Simulates all candidate collisions of the particles in the given band cell
+  */
+  void collide_cell(int);
+
+  /*! \fn void WallCollisionHandler::update_majorants(void)
+      \brief Updates majorants according to the predefined coefficients alpha_1, alpha_1
+
+      As for gas-gas collisions (see CollisionHandler::update_majorants_cell), each
+      band cell adapts its own majorant if PER_CELL_MAJORANTS: out-of-range and real
+      collisions are compared within the cell, as alpha_1 and alpha_2 are tuned for;
+      otherwise the counts of the whole band control all cells
+  */
+  void update_majorants(void);
+
+public:
+
+  WallCollisionHandler(DSMC*);
+  ~WallCollisionHandler() = default;
+
+  // Each step of collisional stage (including initialization)
+  void compute_majorants(void);
+  void compute_collision_number(void);
+  void perform_collisions(void);
+
+  // Collisional stage in a packet
+  void perform_collision_kernel(void);
+
+  /*! \fn void WallCollisionHandler::save_checkpoint(ev_checkpoint::CheckpointWriter&) const
+      \brief Writes majorants and collision statistics
+  */
+  void save_checkpoint(ev_checkpoint::CheckpointWriter&) const;
+
+  /*! \fn void WallCollisionHandler::load_checkpoint(ev_checkpoint::CheckpointReader&)
+      \brief Restores the state written by save_checkpoint (replaces compute_majorants)
+  */
+  void load_checkpoint(ev_checkpoint::CheckpointReader&);
 
-Class containing data for wall density:
-  - a12
-  - freq12
-  - vrmax12
+  // GETTERS
+  inline int get_n_fake(void) const { return n_fake; }
+  inline int get_n_real(void) const { return n_real; }
+  inline int get_n_total(void) const { return n_total; }
+  inline int get_n_band_cells(void) const { return band_cells.size(); }
+  inline real_number get_n_wall(void) const { return n_wall; }
+  inline real_number get_chi_wall(void) const { return chi_wall; }
+  inline const ev_matrix::MaskMatrix<real_number>& get_a12(void) const { return a12; }
+  inline const ev_matrix::MaskMatrix<real_number>& get_vrmax12(void) const { return vrmax12; }
+  inline const ev_matrix::MaskMatrix<real_number>& get_freq12(void) const { return freq12; }
 
-*/
+};
 
 #endif /* WALL_COLLISIONS_HPP */